@@ -0,0 +1,452 @@
+//lang::Cpp
+
+
+/**
+ * ColumnIndex: Point-lookup index on a column of a .sor file
+ *
+ * Author: cao.yuan1@husky.neu.edu & zhan.d@husky.neu.edu
+ */
+
+
+#pragma once
+
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+
+
+#include "object.h"
+#include "field_array.h"
+#include "helper.h"
+#include "types.h"
+
+
+// identifies a column index file and the version of its layout
+const char COLUMN_INDEX_MAGIC[8] = {'S', 'O', 'R', 'C', 'I', 'X', '0', '2'};
+
+// the number of rows covered by each Bloom filter
+const size_t BLOOM_BLOCK_ROWS = 4096;
+
+// the number of Bloom filter bits per row of a block
+const size_t BLOOM_BITS_PER_ROW = 10;
+
+// the number of bits set in a Bloom filter per value
+const size_t BLOOM_HASHES = 7;
+
+// the number of bytes at the start of the file used to detect a different file
+const size_t COLUMN_INDEX_PREFIX = 4096;
+
+
+/**
+ * ColumnIndex: represents a secondary index on one column of a portion of a .sor file.
+ * It is made of a hash index from the hash of each value to the rows holding it, stored
+ * bucket by bucket, and of one Bloom filter per block of BLOOM_BLOCK_ROWS rows.
+ * An index read back from a file keeps the hash index on disk and only reads the one
+ * bucket a lookup needs. Looking a value up in it first asks the Bloom filters, so a value
+ * missing from the column usually never reads the hash index.
+ * An index file is only trusted for the same file, as told by its inode, modification
+ * time and size, only if its length is the one its header implies, and its entries are
+ * checked to be within the indexed rows before they are read.
+ * Lookups in an index kept in memory can be made from several threads at once.
+ * INVARIANT: the entries of a bucket are sorted by row, and rows_, starts_ and ends_
+ * refer to the same entry at the same position.
+ */
+class ColumnIndex : public Object {
+
+public:
+    size_t col_; // the indexed column
+    size_t from_; // the first byte of the indexed portion of the file
+    size_t end_; // the end byte of the indexed portion of the file
+    size_t file_size_; // the size of the indexed file
+    size_t file_ino_; // the inode of the indexed file
+    size_t file_mtime_; // when the indexed file was last modified
+    size_t prefix_hash_; // the hash of the first bytes of the indexed file
+    Types type_; // the type of the indexed column
+    size_t num_rows_; // the number of indexed rows
+    size_t num_blocks_; // the number of Bloom filters
+    size_t bloom_words_; // the number of 64 bits words of each Bloom filter
+    uint64_t* blooms_; // the Bloom filters, one after the other (owned)
+    size_t num_buckets_; // the number of buckets, a power of 2
+    size_t* buckets_; // where each bucket starts among the entries, null if on disk (owned)
+    int* rows_; // the row of each entry, null if on disk (owned)
+    int* starts_; // the starting byte of the field of each entry, null if on disk (owned)
+    int* ends_; // the ending byte of the field of each entry, null if on disk (owned)
+    FILE* in_; // the index file holding the hash index, null if in memory (owned)
+    long table_pos_; // where the hash index starts in the index file
+
+    /**
+     * Default constructor, creates an index of nothing.
+     */
+    ColumnIndex() : Object() {
+        this->col_ = 0;
+        this->from_ = 0;
+        this->end_ = 0;
+        this->file_size_ = 0;
+        this->file_ino_ = 0;
+        this->file_mtime_ = 0;
+        this->prefix_hash_ = 0;
+        this->type_ = Types::FIELD;
+        this->num_rows_ = 0;
+        this->num_blocks_ = 0;
+        this->bloom_words_ = 0;
+        this->blooms_ = nullptr;
+        this->num_buckets_ = 0;
+        this->buckets_ = nullptr;
+        this->rows_ = nullptr;
+        this->starts_ = nullptr;
+        this->ends_ = nullptr;
+        this->in_ = nullptr;
+        this->table_pos_ = 0;
+    }
+
+    /**
+     * Default destructor.
+     */
+    virtual ~ColumnIndex() {
+        this->clear();
+    }
+
+    /**
+     * Empties this index so that it indexes nothing.
+     */
+    virtual void clear() {
+        delete[] this->blooms_;
+        delete[] this->buckets_;
+        delete[] this->rows_;
+        delete[] this->starts_;
+        delete[] this->ends_;
+        if (this->in_) {
+            fclose(this->in_);
+        }
+        this->num_rows_ = 0;
+        this->num_blocks_ = 0;
+        this->num_buckets_ = 0;
+        this->blooms_ = nullptr;
+        this->buckets_ = nullptr;
+        this->rows_ = nullptr;
+        this->starts_ = nullptr;
+        this->ends_ = nullptr;
+        this->in_ = nullptr;
+    }
+
+    /**
+     * Indexes the given column of a portion of a file.
+     *
+     * @param file the file we are working on.
+     * @param file_size the size of the file.
+     * @param file_ino the inode of the file.
+     * @param file_mtime when the file was last modified.
+     * @param from the first byte of the portion the column was made from.
+     * @param end the end byte of the portion the column was made from.
+     * @param col the index of the column in the schema.
+     * @param column the column to index.
+     * @param type the type to read the values as, the type of the column if FIELD.
+     */
+    virtual void build(char* file, size_t file_size, size_t file_ino, size_t file_mtime,
+                       size_t from, size_t end, size_t col, FieldArray* column,
+                       Types type = Types::FIELD) {
+        this->clear();
+        this->col_ = col;
+        this->from_ = from;
+        this->end_ = end;
+        this->file_size_ = file_size;
+        this->file_ino_ = file_ino;
+        this->file_mtime_ = file_mtime;
+        this->prefix_hash_ = hash_prefix_(file, file_size);
+        this->type_ = type == Types::FIELD ? column->type_ : type;
+        this->num_rows_ = column->len();
+
+        // one Bloom filter per block of rows
+        this->num_blocks_ = (this->num_rows_ + BLOOM_BLOCK_ROWS - 1) / BLOOM_BLOCK_ROWS;
+        this->bloom_words_ = (BLOOM_BLOCK_ROWS * BLOOM_BITS_PER_ROW + 63) / 64;
+        this->blooms_ = new uint64_t[this->num_blocks_ * this->bloom_words_]();
+
+        // at least as many buckets as rows, so buckets hold about one value
+        this->num_buckets_ = 1;
+        while (this->num_buckets_ < this->num_rows_) {
+            this->num_buckets_ *= 2;
+        }
+        size_t* hashes = new size_t[this->num_rows_];
+        this->buckets_ = new size_t[this->num_buckets_ + 1]();
+        for (size_t i = 0; i < this->num_rows_; ++i) {
+            hashes[i] = hash_field(file, column->get_start(i), column->get_end(i), this->type_);
+            this->bloom_add_(i / BLOOM_BLOCK_ROWS, hashes[i]);
+            this->buckets_[(hashes[i] & (this->num_buckets_ - 1)) + 1] += 1;
+        }
+        for (size_t b = 0; b < this->num_buckets_; ++b) {
+            this->buckets_[b + 1] += this->buckets_[b];
+        }
+        // place the rows in their bucket, in row order
+        size_t* next = new size_t[this->num_buckets_];
+        memcpy(next, this->buckets_, this->num_buckets_ * sizeof(size_t));
+        this->rows_ = new int[this->num_rows_];
+        this->starts_ = new int[this->num_rows_];
+        this->ends_ = new int[this->num_rows_];
+        for (size_t i = 0; i < this->num_rows_; ++i) {
+            size_t pos = next[hashes[i] & (this->num_buckets_ - 1)]++;
+            this->rows_[pos] = (int) i;
+            this->starts_[pos] = column->get_start(i);
+            this->ends_[pos] = column->get_end(i);
+        }
+        delete[] next;
+        delete[] hashes;
+    }
+
+    /**
+     * Determines whether this index was built from the given column of the given
+     * portion of the given file.
+     *
+     * @param file the file we are working on.
+     * @param file_size the size of the file.
+     * @param file_ino the inode of the file.
+     * @param file_mtime when the file was last modified.
+     * @param from the first byte of the portion.
+     * @param end the end byte of the portion.
+     * @param col the index of the column in the schema.
+     * @return whether it was.
+     */
+    virtual bool matches(char* file, size_t file_size, size_t file_ino, size_t file_mtime,
+                         size_t from, size_t end, size_t col) {
+        return this->blooms_ && this->col_ == col && this->from_ == from && this->end_ == end
+               && this->file_size_ == file_size && this->file_ino_ == file_ino
+               && this->file_mtime_ == file_mtime
+               && this->prefix_hash_ == hash_prefix_(file, file_size);
+    }
+
+    /**
+     * Finds the rows whose field holds the same value as the given field.
+     *
+     * @param file the file we are working on.
+     * @param value the buffer holding the value to look for.
+     * @param start the byte position of '<' of the value in its buffer.
+     * @param end the byte position of '>' of the value in its buffer.
+     * @param found stores the rows found, in increasing order, each paired with the
+     *              starting byte of its field (get_start is the row, get_end the byte).
+     * @return false if the bucket of the value could not be read from the index file or
+     *         holds entries outside the indexed rows, in which case nothing is appended
+     *         to found, true otherwise.
+     * MUTATION: the rows found are appended to found.
+     */
+    virtual bool lookup(char* file, char* value, size_t start, size_t end, FieldArray* found) {
+        size_t hash = hash_field(value, start, end, this->type_);
+        // reading a bucket from disk costs more than asking every Bloom filter
+        bool maybe = !this->in_;
+        for (size_t block = 0; block < this->num_blocks_ && !maybe; ++block) {
+            maybe = this->bloom_test_(block, hash);
+        }
+        if (!maybe) {
+            return true;
+        }
+        size_t bucket = hash & (this->num_buckets_ - 1);
+        size_t first = 0;
+        size_t count = 0;
+        int* rows = nullptr;
+        int* starts = nullptr;
+        int* ends = nullptr;
+        if (this->in_) {
+            // read the bucket bounds and the bucket entries only
+            size_t bounds[2];
+            if (fseek(this->in_, this->table_pos_ + bucket * sizeof(size_t), SEEK_SET) != 0
+                || fread(bounds, sizeof(size_t), 2, this->in_) != 2
+                || bounds[0] > bounds[1] || bounds[1] > this->num_rows_) {
+                return false;
+            }
+            count = bounds[1] - bounds[0];
+            rows = new int[count];
+            starts = new int[count];
+            ends = new int[count];
+            long entries_pos = this->table_pos_ + (this->num_buckets_ + 1) * sizeof(size_t);
+            int* arrays[3] = {rows, starts, ends};
+            bool ok = true;
+            for (size_t a = 0; a < 3 && ok; ++a) {
+                long pos = entries_pos + (a * this->num_rows_ + bounds[0]) * sizeof(int);
+                ok = fseek(this->in_, pos, SEEK_SET) == 0
+                     && fread(arrays[a], sizeof(int), count, this->in_) == count;
+            }
+            // entries pointing outside the rows or the portion would be read past the file
+            for (size_t i = 0; i < count && ok; ++i) {
+                ok = rows[i] >= 0 && (size_t) rows[i] < this->num_rows_
+                     && starts[i] >= 0 && (size_t) starts[i] >= this->from_
+                     && starts[i] <= ends[i] && (size_t) ends[i] < this->end_;
+            }
+            if (!ok) {
+                delete[] rows;
+                delete[] starts;
+                delete[] ends;
+                return false;
+            }
+        } else {
+            first = this->buckets_[bucket];
+            count = this->buckets_[bucket + 1] - first;
+            rows = this->rows_;
+            starts = this->starts_;
+            ends = this->ends_;
+        }
+        for (size_t i = first; i < first + count; ++i) {
+            if (this->bloom_test_(rows[i] / BLOOM_BLOCK_ROWS, hash)
+                && field_equals(file, starts[i], ends[i], value, start, end, this->type_)) {
+                found->pushBack(rows[i], starts[i]);
+            }
+        }
+        if (this->in_) {
+            delete[] rows;
+            delete[] starts;
+            delete[] ends;
+        }
+        return true;
+    }
+
+    /**
+     * Replaces the content of this index by the one stored in the given index file.
+     * Only the Bloom filters are read, the hash index is read bucket by bucket on lookup.
+     * @param path the index file.
+     * @return whether the index file existed, has the length its header implies and was read.
+     */
+    virtual bool load(const char* path) {
+        this->clear();
+        FILE* in = fopen(path, "rb");
+        if (!in) {
+            return false;
+        }
+        char magic[sizeof(COLUMN_INDEX_MAGIC)];
+        int type;
+        bool ok = fread(magic, sizeof(magic), 1, in) == 1
+                  && memcmp(magic, COLUMN_INDEX_MAGIC, sizeof(magic)) == 0
+                  && fread(&this->col_, sizeof(size_t), 1, in) == 1
+                  && fread(&this->from_, sizeof(size_t), 1, in) == 1
+                  && fread(&this->end_, sizeof(size_t), 1, in) == 1
+                  && fread(&this->file_size_, sizeof(size_t), 1, in) == 1
+                  && fread(&this->file_ino_, sizeof(size_t), 1, in) == 1
+                  && fread(&this->file_mtime_, sizeof(size_t), 1, in) == 1
+                  && fread(&this->prefix_hash_, sizeof(size_t), 1, in) == 1
+                  && fread(&type, sizeof(int), 1, in) == 1
+                  && fread(&this->num_rows_, sizeof(size_t), 1, in) == 1
+                  && fread(&this->num_blocks_, sizeof(size_t), 1, in) == 1
+                  && fread(&this->bloom_words_, sizeof(size_t), 1, in) == 1
+                  && fread(&this->num_buckets_, sizeof(size_t), 1, in) == 1;
+        // the header must describe an index build would make
+        ok = ok && this->num_blocks_ == (this->num_rows_ + BLOOM_BLOCK_ROWS - 1) / BLOOM_BLOCK_ROWS
+             && this->bloom_words_ == (BLOOM_BLOCK_ROWS * BLOOM_BITS_PER_ROW + 63) / 64
+             && this->num_buckets_ >= this->num_rows_
+             && (this->num_buckets_ == 1 || this->num_buckets_ / 2 < this->num_rows_)
+             && (this->num_buckets_ & (this->num_buckets_ - 1)) == 0
+             && type >= (int) Types::FIELD && type <= (int) Types::STRING;
+        size_t words = this->num_blocks_ * this->bloom_words_;
+        long header_pos = ok ? ftell(in) : -1;
+        if (ok) {
+            // a cut index file would look its missing buckets up as empty
+            size_t expected = header_pos + words * sizeof(uint64_t)
+                              + (this->num_buckets_ + 1) * sizeof(size_t)
+                              + 3 * this->num_rows_ * sizeof(int);
+            ok = fseek(in, 0, SEEK_END) == 0 && (size_t) ftell(in) == expected
+                 && fseek(in, header_pos, SEEK_SET) == 0;
+        }
+        if (ok) {
+            this->type_ = (Types) type;
+            this->blooms_ = new uint64_t[words];
+            ok = fread(this->blooms_, sizeof(uint64_t), words, in) == words;
+        }
+        if (!ok) {
+            fclose(in);
+            this->clear();
+            return false;
+        }
+        this->table_pos_ = ftell(in);
+        this->in_ = in;
+        return true;
+    }
+
+    /**
+     * Writes this index to the given index file, through a temporary file that then
+     * replaces it, so a concurrent load never reads a partly written index.
+     * @param path the index file.
+     * @return whether the index file was written entirely.
+     */
+    virtual bool save(const char* path) {
+        assert(this->buckets_);
+        char* tmp = temp_path(path);
+        FILE* out = fopen(tmp, "wb");
+        if (!out) {
+            delete[] tmp;
+            return false;
+        }
+        int type = (int) this->type_;
+        size_t words = this->num_blocks_ * this->bloom_words_;
+        bool ok = fwrite(COLUMN_INDEX_MAGIC, sizeof(COLUMN_INDEX_MAGIC), 1, out) == 1
+                  && fwrite(&this->col_, sizeof(size_t), 1, out) == 1
+                  && fwrite(&this->from_, sizeof(size_t), 1, out) == 1
+                  && fwrite(&this->end_, sizeof(size_t), 1, out) == 1
+                  && fwrite(&this->file_size_, sizeof(size_t), 1, out) == 1
+                  && fwrite(&this->file_ino_, sizeof(size_t), 1, out) == 1
+                  && fwrite(&this->file_mtime_, sizeof(size_t), 1, out) == 1
+                  && fwrite(&this->prefix_hash_, sizeof(size_t), 1, out) == 1
+                  && fwrite(&type, sizeof(int), 1, out) == 1
+                  && fwrite(&this->num_rows_, sizeof(size_t), 1, out) == 1
+                  && fwrite(&this->num_blocks_, sizeof(size_t), 1, out) == 1
+                  && fwrite(&this->bloom_words_, sizeof(size_t), 1, out) == 1
+                  && fwrite(&this->num_buckets_, sizeof(size_t), 1, out) == 1
+                  && fwrite(this->blooms_, sizeof(uint64_t), words, out) == words
+                  && fwrite(this->buckets_, sizeof(size_t), this->num_buckets_ + 1, out)
+                     == this->num_buckets_ + 1
+                  && fwrite(this->rows_, sizeof(int), this->num_rows_, out) == this->num_rows_
+                  && fwrite(this->starts_, sizeof(int), this->num_rows_, out) == this->num_rows_
+                  && fwrite(this->ends_, sizeof(int), this->num_rows_, out) == this->num_rows_;
+        ok = fclose(out) == 0 && ok;
+        ok = replace_file(tmp, path, ok);
+        delete[] tmp;
+        return ok;
+    }
+
+    /**
+     * Hashes the bytes at the start of a file.
+     * @param file the file we are working on.
+     * @param file_size the size of the file.
+     * @return the hash of the prefix.
+     */
+    static size_t hash_prefix_(char* file, size_t file_size) {
+        return hash_bytes(file, file_size < COLUMN_INDEX_PREFIX ? file_size : COLUMN_INDEX_PREFIX);
+    }
+
+    /**
+     * Returns the i-th bit a value sets in a Bloom filter, using double hashing.
+     * @param hash the hash of the value.
+     * @param i which of the BLOOM_HASHES bits.
+     * @return the bit.
+     */
+    virtual size_t bloom_bit_(size_t hash, size_t i) {
+        uint64_t h1 = (uint64_t) hash;
+        uint64_t h2 = (h1 * 0x9E3779B97F4A7C15ULL) >> 32 | 1;
+        return (size_t) ((h1 + i * h2) % (this->bloom_words_ * 64));
+    }
+
+    /**
+     * Adds a value to the Bloom filter of a block.
+     * @param block the block.
+     * @param hash the hash of the value.
+     */
+    virtual void bloom_add_(size_t block, size_t hash) {
+        uint64_t* bloom = &this->blooms_[block * this->bloom_words_];
+        for (size_t i = 0; i < BLOOM_HASHES; ++i) {
+            size_t bit = this->bloom_bit_(hash, i);
+            bloom[bit / 64] |= (uint64_t) 1 << (bit % 64);
+        }
+    }
+
+    /**
+     * Asks the Bloom filter of a block whether it may hold a value.
+     * @param block the block.
+     * @param hash the hash of the value.
+     * @return false if the block does not hold the value, true if it may.
+     */
+    virtual bool bloom_test_(size_t block, size_t hash) {
+        uint64_t* bloom = &this->blooms_[block * this->bloom_words_];
+        for (size_t i = 0; i < BLOOM_HASHES; ++i) {
+            size_t bit = this->bloom_bit_(hash, i);
+            if (!(bloom[bit / 64] & ((uint64_t) 1 << (bit % 64)))) {
+                return false;
+            }
+        }
+        return true;
+    }
+};
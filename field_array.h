@@ -13,12 +13,17 @@
 
 #include<cstdlib>
 #include<cassert>
+#include<cstdio>
 
 
 #include "object.h"
 #include "types.h"
 
 
+// the number of fields read or written at once by FieldArray::read and FieldArray::write
+const size_t FIELD_IO_CHUNK = 4096;
+
+
 /**
  * FieldArray: represents a vector storing the starting and ending bytes of
  * fields in a .sor file relative to the start of the file.
@@ -70,7 +75,18 @@ public:
      * Grows the array if it has reached it's capacity limit.
      */
     virtual void resize_() {
-        this->capacity_ *= 2;
+        this->reserve(this->capacity_ * 2);
+    }
+
+    /**
+     * Grows the capacity of this array to at least the given capacity.
+     * @param capacity the capacity to grow to.
+     */
+    virtual void reserve(size_t capacity) {
+        if (capacity <= this->capacity_) {
+            return;
+        }
+        this->capacity_ = capacity;
         int* new_starts = new int[this->capacity_];
         int* new_ends = new int[this->capacity_];
         for(size_t i = 0; i < this->size_; ++i) {
@@ -123,6 +139,51 @@ public:
         this->size_ = 0;
     }
 
+    /**
+     * Writes the starting and ending bytes of the fields from the given one on to a file,
+     * as one pair per field, so that later fields can be appended to the same file.
+     * @param out the file to write to.
+     * @param from the index of the first field to write.
+     * @return whether all of them were written.
+     */
+    virtual bool write(FILE* out, size_t from) {
+        int pairs[2 * FIELD_IO_CHUNK];
+        size_t i = from;
+        while (i < this->size_) {
+            size_t n = 0;
+            for (; n < FIELD_IO_CHUNK && i < this->size_; ++n, ++i) {
+                pairs[2 * n] = this->starts_[i];
+                pairs[2 * n + 1] = this->ends_[i];
+            }
+            if (fwrite(pairs, 2 * sizeof(int), n, out) != n) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    /**
+     * Appends to this field array fields previously written with write().
+     * @param in the file to read from.
+     * @param count the number of fields to read, the file must hold at least that many.
+     * @return whether all of them were read.
+     */
+    virtual bool read(FILE* in, size_t count) {
+        int pairs[2 * FIELD_IO_CHUNK];
+        this->reserve(this->size_ + count);
+        while (count > 0) {
+            size_t n = count < FIELD_IO_CHUNK ? count : FIELD_IO_CHUNK;
+            if (fread(pairs, 2 * sizeof(int), n, in) != n) {
+                return false;
+            }
+            for (size_t k = 0; k < n; ++k) {
+                this->pushBack(pairs[2 * k], pairs[2 * k + 1]);
+            }
+            count -= n;
+        }
+        return true;
+    }
+
     /**
      * Sets the type of this field array if it was not previously set.
      * @param t the type to set.
@@ -5,15 +5,27 @@
 
 
 #include <cassert>
+#include <cstdint>
+#include <cstring>
+#include <cstdio>
 #include <iostream>
 
 
+#include <sys/stat.h>
+#include <unistd.h>
+
+
 #include "object.h"
 #include "field_array.h"
+#include "reject_report.h"
 #include "types.h"
 #include "types_array.h"
 
 
+// the number of lines the schema is inferred from
+const size_t SCHEMA_ROWS = 500;
+
+
 /**
  * Attemps to parse the given value to an unsigned integer.
  * @param c the value to parse
@@ -30,6 +42,133 @@ inline size_t parse_uint(char *c) {
 }
 
 
+/**
+ * Attempts to parse the given comma separated list of columns, such as "1,4,7".
+ * @param c the list to parse.
+ * @param num_col the number of columns of the schema.
+ * @return for each column of the schema whether it is in the list, or null if it was
+ *         unable to parse it or a column is not in the schema.
+ */
+inline bool* parse_projection(const char *c, size_t num_col) {
+    bool* projection = new bool[num_col]();
+    size_t col = 0;
+    bool digits = false;
+    for (;; ++c) {
+        if (*c >= '0' && *c <= '9') {
+            col = col * 10 + (*c - '0');
+            digits = true;
+            if (col >= num_col) {
+                break;
+            }
+        } else if ((*c == ',' || *c == '\0') && digits) {
+            projection[col] = true;
+            col = 0;
+            digits = false;
+            if (*c == '\0') {
+                return projection;
+            }
+        } else {
+            break;
+        }
+    }
+    delete[] projection;
+    return nullptr;
+}
+
+
+/**
+ * Hashes the given number of bytes with FNV-1a.
+ * @param bytes the bytes to hash.
+ * @param len the number of bytes to hash.
+ * @return the hash of the bytes.
+ */
+inline size_t hash_bytes(const char* bytes, size_t len) {
+    uint64_t hash = 14695981039346656037ULL;
+    for (size_t i = 0; i < len; ++i) {
+        hash ^= (unsigned char) bytes[i];
+        hash *= 1099511628211ULL;
+    }
+    return (size_t) hash;
+}
+
+
+/**
+ * Returns when a file was last modified.
+ * @param st the status of the file.
+ * @return the modification time in nanoseconds.
+ */
+inline size_t file_mtime(struct stat* st) {
+    return (size_t) st->st_mtim.tv_sec * 1000000000ULL + (size_t) st->st_mtim.tv_nsec;
+}
+
+
+/**
+ * Returns the path of the temporary file an index file is written to before it replaces
+ * the index file, so that a reader never sees a partly written index.
+ * @param path the index file.
+ * @return the temporary path, unique to this process (owned by the caller).
+ */
+inline char* temp_path(const char* path) {
+    size_t len = strlen(path) + 32;
+    char* tmp = new char[len];
+    snprintf(tmp, len, "%s.tmp.%ld", path, (long) getpid());
+    return tmp;
+}
+
+
+/**
+ * Replaces a file by the temporary file it was written to, or discards the temporary
+ * file if it was not written entirely.
+ * @param tmp the temporary file.
+ * @param path the file to replace.
+ * @param ok whether the temporary file was written entirely.
+ * @return whether the file was replaced.
+ */
+inline bool replace_file(const char* tmp, const char* path, bool ok) {
+    if (ok && rename(tmp, path) == 0) {
+        return true;
+    }
+    remove(tmp);
+    return false;
+}
+
+
+/**
+ * Narrows the bytes given by -from and -len to the lines that are read from them.
+ * The line the first byte falls in is always discarded, since it may have been cut,
+ * unless the first byte is the start of the file. The last line is discarded if the
+ * end cuts it.
+ *
+ * @param file the file we are working on.
+ * @param file_size the size of the file.
+ * @param from the first byte given.
+ * @param len the number of bytes given.
+ * @param start stores the first byte of the first line read.
+ * @param end stores the byte to stop reading at, at or after start.
+ */
+inline void trim_range(char *file, size_t file_size, size_t from, size_t len,
+                       size_t *start, size_t *end) {
+    size_t last = from + len < from ? SIZE_MAX : from + len;
+    if (from != 0) {
+        while (from < file_size && file[from] != '\n') {
+            ++from;
+        }
+        if (from < file_size) {
+            ++from;
+        }
+    }
+    if (last >= file_size) {
+        last = file_size;
+    } else {
+        while (last > from && file[last] != '\n') {
+            --last;
+        }
+    }
+    *start = from;
+    *end = last > from ? last : from;
+}
+
+
 /**
  * Returns the index of the first non space character from a given 'start'
  * to an given 'end' in a 'file'.
@@ -147,25 +286,29 @@ inline void parse_row_schema(char* file, size_t* start, TypesArray* row_schema)
 
 
 /**
- * Parses the schema of the given file.
+ * Merges the schema of the lines of a portion of a file into a schema inferred so far.
  * @param file the file we are working on.
- * @return the schema as an array of types.
+ * @param start the starting byte of the first line to parse.
+ * @param end the byte to stop parsing at, only the lines before it are parsed.
+ * @param result the schema inferred so far.
+ * @param max_rows the maximum number of lines to parse.
+ * @return the number of lines parsed.
+ * MUTATION: result is changed to also fit the lines parsed.
  * INVARIANT: the result TypesArray always stores the correct schema at the beginning of
  * every iteration. Thus, only in the case of finding a longer row or where
  * less restrictive fields are found, is this result array ever changed.
 
  * CREDIT: to SnowyJoe team for the schema parsing algorithm.
  */
-inline TypesArray *parse_schema(char *file) {
-    // stores the schema state so far
-    TypesArray* result = new TypesArray();
-    size_t start = 0;
+inline size_t merge_schema(char *file, size_t start, size_t end, TypesArray* result,
+                           size_t max_rows) {
     // types array to use to store the row schema
     // it is used for all the necessary iterations and only deleted
     // at completion
     TypesArray* curr = new TypesArray();
-    for (size_t i = 0; i < 500; ++i) {
-        if (file[start] == EOF || file[start] == '\0') {
+    size_t i;
+    for (i = 0; i < max_rows; ++i) {
+        if (start >= end || file[start] == EOF || file[start] == '\0') {
             break;
         }
         // pass the curr type array down so to store the row schema
@@ -192,7 +335,24 @@ inline TypesArray *parse_schema(char *file) {
     }
     // we can finally delete curr
     delete curr;
+    return i;
+}
+
 
+/**
+ * Parses the schema of the given file.
+ * @param file the file we are working on.
+ * @param end the byte to stop parsing at, the schema is inferred from the lines before it.
+ * @param rows_read if not null, stores the number of lines the schema was inferred from.
+ * @return the schema as an array of types.
+ */
+inline TypesArray *parse_schema(char *file, size_t end = SIZE_MAX, size_t* rows_read = nullptr) {
+    // stores the schema state so far
+    TypesArray* result = new TypesArray();
+    size_t rows = merge_schema(file, 0, end, result, SCHEMA_ROWS);
+    if (rows_read) {
+        *rows_read = rows;
+    }
     return result;
 }
 
@@ -228,25 +388,145 @@ inline void parse_row_fields(char* file, size_t* start, FieldArray* row) {
 
 
 /**
- * Determines if the types row are valid according to a schema passed in.
- * A row is valid if and only if both the number of fields in the row and their types
- * respectively matches those of the schema.
+ * Finds the fields of a row (line) like parse_row_fields, but gives up on the row as soon
+ * as it has more fields than the schema, skipping the rest of it.
+ *
+ * @param file the file we are working on.
+ * @param start the starting byte to read from.
+ * @param row the field array to fill with the starting and ending bytes found.
+ * @param max_fields the number of fields of the schema.
+ * @return whether the row has as many fields as the schema.
+ * MUTATION: the start argument is mutated so that it always holds the byte
+ *           where this row parsing ended. The row argument is mutated to store
+ *           the the starting and ending bytes found, up to max_fields of them.
+ */
+inline bool parse_row_arity(char* file, size_t* start, FieldArray* row, size_t max_fields) {
+    while (file[*start] != '\n' && file[*start] != EOF && file[*start] != '\0') {
+        // find the starting byte of the field
+        if (file[*start] == '<') {
+            if (row->len() == max_fields) {
+                // one field too many, the types of the row do not matter
+                while (file[*start] != '\n' && file[*start] != EOF && file[*start] != '\0') {
+                    *start += 1;
+                }
+                return false;
+            }
+            size_t field_end = *start + 1;
+            // find the ending byte of the field
+            while (file[field_end] != '>') {
+                assert(file[field_end] != '\n');
+                ++field_end;
+            }
+            row->pushBack(*start, field_end);
+            *start = field_end + 1;
+        } else {
+            *start += 1;
+        }
+    }
+    return row->len() == max_fields;
+}
+
+
+/**
+ * Determines if the fields of a row with as many fields as the schema are valid according
+ * to it. The fields of a STRING column are always valid, so only the others are parsed.
  *
- * @param row_types the types array of the row to check.
+ * @param file the file we are working on.
+ * @param row_fields the starting and ending bytes of the fields of the row.
  * @param schema the schema of .sor file.
  * @return whether it is valid or not.
  */
-inline bool is_valid_row(TypesArray* row_types, TypesArray* schema) {
+inline bool is_valid_fields(char* file, FieldArray* row_fields, TypesArray* schema) {
     size_t max_fields = schema->len();
-    if (row_types->len() == max_fields) {
-        for (size_t i = 0; i < max_fields; ++i) {
-            if (row_types->get(i) > schema->get(i)) {
-                return false;
+    for (size_t i = 0; i < max_fields; ++i) {
+        Types t = schema->get(i);
+        if (t < Types::STRING
+            && parse_field_type(file, row_fields->get_start(i), row_fields->get_end(i)) > t) {
+            return false;
+        }
+    }
+    return true;
+}
+
+
+/**
+ * Appends the valid rows of a portion of a file delimited by the given start and end
+ * to an existing columnar representation built according to a schema.
+ * Rows are validated in two stages: rows without as many fields as the schema are
+ * rejected first, then only the fields of the columns narrower than STRING are parsed.
+ *
+ * NOTE: the function assumes that start always points to the beginning of a line
+ *       and the end to the end of a line.
+ *
+ * @param file the file we are working on.
+ * @param start the starting byte to read from.
+ * @param end the ending byte to read to.
+ * @param schema the schema.
+ * @param columnar the columnar representation to append the valid rows to, if null
+ *                 the rows are only validated. Null columns are left out, but every
+ *                 field of a row is still checked against the schema.
+ * @param rejected if not null, stores the starting and ending bytes of every row
+ *                 that did not match the schema.
+ * @param rows if not null, stores the starting and ending bytes of every valid row.
+ * @param max_rows the number of valid rows after which to stop.
+ * @param report if not null, counts the rows that did not match the schema.
+ * @return the byte where reading stopped, the beginning of the line after the last one read.
+ * MUTATION: the field arrays of columnar, rejected and rows, and the report, if given,
+ *           are appended to.
+ */
+inline size_t append_columnar(char* file, size_t start, size_t end, TypesArray* schema,
+                              FieldArray** columnar, FieldArray* rejected = nullptr,
+                              FieldArray* rows = nullptr, size_t max_rows = SIZE_MAX,
+                              RejectReport* report = nullptr) {
+    size_t max_fields = schema->len();
+    size_t num_rows = 0;
+    // initialized the array that is going to be recycled every iteration
+    FieldArray* row_fields = new FieldArray();
+    while (num_rows < max_rows && start < end && file[start] != EOF && file[start] != '\0') {
+        // skip empty lines
+        if (file[start] == '\n') {
+            ++start;
+            if (report) {
+                ++report->line_;
             }
+            continue;
         }
-        return true;
+        size_t row_start = start;
+        // first check the number of fields, then their types
+        bool valid = parse_row_arity(file, &row_start, row_fields, max_fields)
+                     && is_valid_fields(file, row_fields, schema);
+
+        if (valid) {
+            ++num_rows;
+            if (rows) {
+                rows->pushBack(start, row_start);
+            }
+            if (columnar) {
+                for (size_t i = 0; i < max_fields; ++i) {
+                    if (columnar[i]) {
+                        columnar[i]->pushBack(row_fields->get_start(i), row_fields->get_end(i));
+                    }
+                }
+            }
+        } else {
+            if (rejected) {
+                rejected->pushBack(start, row_start);
+            }
+            if (report) {
+                report->reject();
+            }
+        }
+        if (report) {
+            ++report->line_;
+        }
+        // recycle the row_fields array
+        row_fields->clear();
+        // move cursor to point to next line
+        start = row_start + 1;
     }
-    return false;
+    // we are done so we delete it
+    delete row_fields;
+    return start;
 }
 
 
@@ -261,46 +541,163 @@ inline bool is_valid_row(TypesArray* row_types, TypesArray* schema) {
  * @param start the starting byte to read from.
  * @param end the ending byte to read to.
  * @param schema the schema.
+ * @param rejected if not null, stores the starting and ending bytes of every row
+ *                 that did not match the schema.
+ * @param rows if not null, stores the starting and ending bytes of every valid row.
+ * @param projection if not null, tells for each column of the schema whether to build it.
+ *                   The columns not built are null, rows are still validated against
+ *                   the whole schema.
+ * @param report if not null, counts the rows that did not match the schema.
  * @return an array of field arrays which are the columnar representation of this portion of file
  */
-inline FieldArray** make_columnar(char* file, size_t start, size_t end, TypesArray* schema) {
+inline FieldArray** make_columnar(char* file, size_t start, size_t end, TypesArray* schema,
+                                  FieldArray* rejected = nullptr, FieldArray* rows = nullptr,
+                                  bool* projection = nullptr, RejectReport* report = nullptr) {
     size_t max_fields = schema->len();
     FieldArray** columnar = new FieldArray*[max_fields];
     for (size_t i = 0; i < max_fields; ++i) {
-        columnar[i] = new FieldArray();
-        columnar[i]->set_type(schema->get(i));
-    }
-    while (start < end) {
-        // initialized the arrays that are going to be recycled every iteration
-        TypesArray* row_types = new TypesArray();
-        FieldArray* row_fields = new FieldArray();
-        while (file[start] != '\n' && file[start] != EOF && file[start] != '\0') {
-            size_t row_start = start;
-            // first parse the schema and determine if the row is valid
-            parse_row_schema(file, &row_start, row_types);
-
-            if (is_valid_row(row_types, schema)) {
-                // if valid we parse the row fields and add it to our columnar
-                parse_row_fields(file, &start, row_fields);
-                for (size_t i = 0; i < max_fields; ++i) {
-                    columnar[i]->pushBack(row_fields->get_start(i), row_fields->get_end(i));
-                }
-                // recycle the row_fields array
-                row_fields->clear();
-            }
-            // recycle the row_types array
-            row_types->clear();
-            // move cursor to point to next line
-            start = row_start + 1;
+        columnar[i] = nullptr;
+        if (!projection || projection[i]) {
+            columnar[i] = new FieldArray();
+            columnar[i]->set_type(schema->get(i));
         }
-        // we are done so we delete them
-        delete row_types;
-        delete row_fields;
     }
+    append_columnar(file, start, end, schema, columnar, rejected, rows, SIZE_MAX, report);
     return columnar;
 }
 
 
+/**
+ * Creates the row table of a portion of a file delimited by the given start and end
+ * according to a schema: the starting and ending bytes of every valid row, so that
+ * the n-th valid row can be found without parsing the rows before it.
+ *
+ * NOTE: the function assumes that start always points to the beginning of a line
+ *       and the end to the end of a line.
+ *
+ * @param file the file we are working on.
+ * @param start the starting byte to read from.
+ * @param end the ending byte to read to.
+ * @param schema the schema.
+ * @param report if not null, counts the rows that did not match the schema.
+ * @return the field array of the starting and ending bytes of the valid rows.
+ */
+inline FieldArray* make_row_index(char* file, size_t start, size_t end, TypesArray* schema,
+                                  RejectReport* report = nullptr) {
+    FieldArray* rows = new FieldArray();
+    append_columnar(file, start, end, schema, nullptr, nullptr, rows, SIZE_MAX, report);
+    return rows;
+}
+
+
+/**
+ * Deletes a columnar representation made of the given number of columns.
+ * @param columnar the columnar representation to delete.
+ * @param num_col the number of columns in it.
+ */
+inline void delete_columnar(FieldArray** columnar, size_t num_col) {
+    for (size_t k = 0; k < num_col; ++k) {
+        delete columnar[k];
+    }
+    delete[] columnar;
+}
+
+
+/**
+ * Finds the bytes holding the value of the field delimited by '<' and '>' at start and end,
+ * leaving out the spaces around it and, for strings, the quotes around it.
+ *
+ * @param file the file we are working on.
+ * @param start the byte position of '<'
+ * @param end the byte position of '>'
+ * @param t the type of the field.
+ * @param value_start stores the first byte of the value.
+ * @param value_end stores the last byte of the value.
+ * @return false if the field is missing, true otherwise.
+ */
+inline bool field_value(char* file, size_t start, size_t end, Types t,
+                        size_t* value_start, size_t* value_end) {
+    size_t new_start = triml(file, start, end);
+    size_t new_end = trimr(file, start, end);
+    if (new_start > new_end) {
+        return false;
+    }
+    if (t == Types::STRING && new_start < new_end
+        && file[new_start] == '\"' && file[new_end] == '\"') {
+        ++new_start;
+        --new_end;
+    }
+    *value_start = new_start;
+    *value_end = new_end;
+    return true;
+}
+
+
+/**
+ * Hashes the content of the field delimited by '<' and '>' at start and end so that
+ * fields holding the same value of type t hash the same, e.g. <1> and < +1 > for an INT.
+ *
+ * @param file the file we are working on.
+ * @param start the byte position of '<'
+ * @param end the byte position of '>'
+ * @param t the type to read the field as.
+ * @return the hash of the value of the field.
+ */
+inline size_t hash_field(char* file, size_t start, size_t end, Types t) {
+    size_t value_start;
+    size_t value_end;
+    if (!field_value(file, start, end, t, &value_start, &value_end)) {
+        return 0;
+    }
+    if (t == Types::BOOL || t == Types::INT) {
+        long long val = strtoll(&file[value_start], nullptr, 10);
+        return hash_bytes((char*) &val, sizeof(val));
+    } else if (t == Types::FLOAT) {
+        // hash as a double with no negative zero so equal values hash the same
+        double val = (double) strtold(&file[value_start], nullptr) + 0.0;
+        return hash_bytes((char*) &val, sizeof(val));
+    }
+    // empty strings ("") hash differently than missing fields
+    return hash_bytes(&file[value_start], value_end + 1 - value_start) + 1;
+}
+
+
+/**
+ * Determines whether two fields, each delimited by '<' and '>' at their start and end,
+ * hold the same value of type t. Two missing fields are equal.
+ *
+ * @param file_a the file of the first field.
+ * @param start_a the byte position of '<' of the first field.
+ * @param end_a the byte position of '>' of the first field.
+ * @param file_b the file of the second field.
+ * @param start_b the byte position of '<' of the second field.
+ * @param end_b the byte position of '>' of the second field.
+ * @param t the type to read the fields as.
+ * @return whether they are equal.
+ */
+inline bool field_equals(char* file_a, size_t start_a, size_t end_a,
+                         char* file_b, size_t start_b, size_t end_b, Types t) {
+    size_t a_start = 0, a_end = 0, b_start = 0, b_end = 0;
+    bool a_present = field_value(file_a, start_a, end_a, t, &a_start, &a_end);
+    bool b_present = field_value(file_b, start_b, end_b, t, &b_start, &b_end);
+    if (!a_present || !b_present) {
+        return a_present == b_present;
+    }
+    if (t == Types::BOOL || t == Types::INT) {
+        return strtoll(&file_a[a_start], nullptr, 10) == strtoll(&file_b[b_start], nullptr, 10);
+    } else if (t == Types::FLOAT) {
+        return (double) strtold(&file_a[a_start], nullptr)
+               == (double) strtold(&file_b[b_start], nullptr);
+    }
+    // an empty quoted string has no bytes left once its quotes are removed
+    if (a_start > a_end || b_start > b_end) {
+        return a_start > a_end && b_start > b_end;
+    }
+    return a_end - a_start == b_end - b_start
+           && memcmp(&file_a[a_start], &file_b[b_start], a_end + 1 - a_start) == 0;
+}
+
+
 /**
  * Print the given type to std out.
  * @param t the type to print.
@@ -342,7 +739,7 @@ inline void print_field(char *file, int start, int end, Types t) {
     size_t new_end = trimr(file, start, end);
 
     // check if it is an empty field
-    if (new_start < new_end) {
+    if (new_start <= new_end) {
         switch (t) {
             case Types::BOOL:
                 std::cout << file[new_start] << "\n";
@@ -373,3 +770,95 @@ inline void print_field(char *file, int start, int end, Types t) {
         std::cout << 1 << "\n";
     }
 }
+
+
+/**
+ * Print to std out every field of the row starting at the given byte, one per line.
+ *
+ * @param file the file to read from.
+ * @param start the starting byte of the row.
+ * @param schema the schema of the file.
+ */
+inline void print_row(char *file, size_t start, TypesArray* schema) {
+    FieldArray* row_fields = new FieldArray();
+    parse_row_fields(file, &start, row_fields);
+    size_t num_col = schema->len();
+    for (size_t i = 0; i < num_col; ++i) {
+        print_field(file, row_fields->get_start(i), row_fields->get_end(i), schema->get(i));
+    }
+    delete row_fields;
+}
+
+
+/**
+ * Writes to std out the row starting and ending at the given bytes as it is in the file.
+ *
+ * @param file the file to read from.
+ * @param start the starting byte of the row.
+ * @param end the ending byte of the row, its '\n'.
+ * @param projection if not null, tells for each field whether to write it, the fields
+ *                   written are then separated by a single space.
+ */
+inline void dump_row(char *file, size_t start, size_t end, bool* projection = nullptr) {
+    if (!projection) {
+        std::cout.write(&file[start], end - start);
+        std::cout << '\n';
+        return;
+    }
+    FieldArray* row_fields = new FieldArray();
+    parse_row_fields(file, &start, row_fields);
+    bool first = true;
+    for (size_t i = 0; i < row_fields->len(); ++i) {
+        if (projection[i]) {
+            if (!first) {
+                std::cout << ' ';
+            }
+            std::cout.write(&file[row_fields->get_start(i)],
+                            row_fields->get_end(i) + 1 - row_fields->get_start(i));
+            first = false;
+        }
+    }
+    std::cout << '\n';
+    delete row_fields;
+}
+
+
+/**
+ * Counts the lines that end before the given byte.
+ * @param file the file we are working on.
+ * @param end the byte to stop counting at.
+ * @return the number of '\n' before end.
+ */
+inline size_t count_lines(char *file, size_t end) {
+    size_t lines = 0;
+    size_t pos = 0;
+    while (pos < end) {
+        char *newline = (char *) memchr(&file[pos], '\n', end - pos);
+        if (!newline) {
+            break;
+        }
+        ++lines;
+        pos = newline - file + 1;
+    }
+    return lines;
+}
+
+
+/**
+ * Writes to std out two rows, each starting and ending at the given bytes of their file,
+ * as a single row made of the fields of the first followed by those of the second.
+ *
+ * @param file_a the file of the first row.
+ * @param start_a the starting byte of the first row.
+ * @param end_a the ending byte of the first row, its '\n'.
+ * @param file_b the file of the second row.
+ * @param start_b the starting byte of the second row.
+ * @param end_b the ending byte of the second row, its '\n'.
+ */
+inline void dump_joined_row(char *file_a, size_t start_a, size_t end_a,
+                            char *file_b, size_t start_b, size_t end_b) {
+    std::cout.write(&file_a[start_a], end_a - start_a);
+    std::cout << ' ';
+    std::cout.write(&file_b[start_b], end_b - start_b);
+    std::cout << '\n';
+}
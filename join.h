@@ -0,0 +1,93 @@
+//lang::Cpp
+
+
+/**
+ * Joining the rows of two .sor files on equal values
+ *
+ * Author: cao.yuan1@husky.neu.edu & zhan.d@husky.neu.edu
+ */
+
+
+#pragma once
+
+
+#include <thread>
+
+
+#include "column_index.h"
+#include "field_array.h"
+#include "helper.h"
+#include "sort.h"
+#include "types.h"
+
+
+/**
+ * Finds the pairs of rows of two columns that hold the same value with a hash join.
+ * The smaller column is put in a hash index on the content of its values, which the rows of
+ * the larger one look up in parallel, each thread taking its own slice of them.
+ * Values are compared as the least restrictive type of the two columns, so an INT column
+ * can be joined with a FLOAT one. Missing values match no row.
+ *
+ * @param left_file the file of the left column.
+ * @param left_col the left column.
+ * @param right_file the file of the right column.
+ * @param right_col the right column.
+ * @return the pairs of matching rows, the left row as the start and the right row as the end,
+ *         ordered by the rows of the larger column and then by those of the smaller one.
+ */
+inline FieldArray* hash_join(char* left_file, FieldArray* left_col,
+                             char* right_file, FieldArray* right_col) {
+    Types type = left_col->type_ < right_col->type_ ? right_col->type_ : left_col->type_;
+    bool build_left = left_col->len() <= right_col->len();
+    char* build_file = build_left ? left_file : right_file;
+    FieldArray* build_col = build_left ? left_col : right_col;
+    char* probe_file = build_left ? right_file : left_file;
+    FieldArray* probe_col = build_left ? right_col : left_col;
+
+    ColumnIndex* index = new ColumnIndex();
+    index->build(build_file, 0, 0, 0, 0, 0, 0, build_col, type);
+
+    size_t n = probe_col->len();
+    size_t threads = sort_threads(n);
+    size_t slice = (n + threads - 1) / threads;
+    FieldArray** matches = new FieldArray*[threads];
+    std::thread* workers = new std::thread[threads];
+    for (size_t t = 0; t < threads; ++t) {
+        matches[t] = new FieldArray();
+        workers[t] = std::thread([=]() {
+            FieldArray* found = new FieldArray();
+            size_t end = std::min(n, (t + 1) * slice);
+            for (size_t row = t * slice; row < end; ++row) {
+                size_t value_start;
+                size_t value_end;
+                if (!field_value(probe_file, probe_col->get_start(row), probe_col->get_end(row),
+                                 type, &value_start, &value_end)) {
+                    continue;
+                }
+                index->lookup(build_file, probe_file, probe_col->get_start(row),
+                              probe_col->get_end(row), found);
+                for (size_t k = 0; k < found->len(); ++k) {
+                    if (build_left) {
+                        matches[t]->pushBack(found->get_start(k), row);
+                    } else {
+                        matches[t]->pushBack(row, found->get_start(k));
+                    }
+                }
+                found->clear();
+            }
+            delete found;
+        });
+    }
+    FieldArray* result = new FieldArray();
+    for (size_t t = 0; t < threads; ++t) {
+        workers[t].join();
+        for (size_t k = 0; k < matches[t]->len(); ++k) {
+            result->pushBack(matches[t]->get_start(k), matches[t]->get_end(k));
+        }
+        delete matches[t];
+    }
+    delete[] workers;
+    delete[] matches;
+    delete index;
+    return result;
+}
@@ -9,17 +9,50 @@
  *             -print_col_type asks for the type of the col indicated
  *             -print_col_idx asks for the value of the field at the col, idx
  *             -is_missing_idx asks whether the field at col, idx is an empty/missing value
+ *             -index keeps an index of the file in the given index file and in segment files
+ *                    next to it, so that the next run only parses the lines appended to the
+ *                    file since and only reads the columns it needs
+ *             -row_from tells you the first valid row to read
+ *             -row_count tells you how many valid rows to read
+ *             -print_row asks for the values of every field of the valid row indicated
+ *             -find asks for the valid rows whose field at col holds the given value
+ *             -col_index keeps a hash index and Bloom filters of the column searched by -find
+ *                        in the given index file, so that the next -find on it skips the scan
+ *             -sort_by asks for the valid rows ordered by the value of their field at col,
+ *                      in asc (default) or desc order
+ *             -missing_first puts the rows missing a value first when sorting, instead of last
+ *             -dump writes the rows asked for as they are in the file, instead of their index
+ *             -cols restricts the fields written by -dump to the given comma separated columns
+ *             -join asks for the valid rows of the file joined with those of another file
+ *                   whose field at the other col holds the same value as theirs at col
+ *             -count writes the number of rows found by -find or -join instead of the rows
+ *             -approx_distinct asks for the approximate number of distinct values of the col
+ *             -approx_quantile asks for the approximate value of the col at the given rank,
+ *                              from 0 for the smallest value to 1 for the largest
+ *             -rejects writes to std err the number of rows that do not match the schema among
+ *                      those read and the lines of the first of them
+ *             -mem_limit reads the file one window at a time so that the memory used stays
+ *                        within the given number of bytes, whatever the size of the file
  *
- * Unless, -print_col_type, print_col_idx, is_missing_idx options are used, nothing will happen.
+ * Unless, -print_col_type, print_col_idx, is_missing_idx, print_row, find, sort_by, join,
+ * approx_distinct, approx_quantile options are used,
+ * nothing will happen.
  *
  * If those options are used, a -f must be included.
  *
  * If no -len or no -from options are given, we assume the whole file must be read.
+ * The -index option always reads the whole file and cannot be used with -from or -len.
+ * It leaves out a last line that does not end with '\n', which may still be being written,
+ * and cannot index a file larger than INT_MAX bytes.
+ * The -row_from and -row_count options select rows among those chosen by -from and -len,
+ * and the rows and idx asked for are relative to -row_from.
+ * The -mem_limit option cannot be used with -index, -col_index, -sort_by or -join.
  */
 
 
 #include <iostream>
 #include <cassert>
+#include <climits>
 #include <cstdio>
 #include <string.h>
 
@@ -30,25 +63,117 @@
 #include <sys/mman.h>
 
 
+#include "column_index.h"
 #include "helper.h"
+#include "join.h"
+#include "query.h"
+#include "sor_index.h"
+#include "sort.h"
+#include "window_scanner.h"
 
 
-const char *USAGE = "Usage: ./sorer [-f] [-from] [-len] [-print_col_type] " \
-             "[-print_col_idx] [-is_missing_idx]\n" \
+const char *USAGE = "Usage: ./sorer [-f] [-from] [-len] [-index] [-row_from] [-row_count] [-col_index] " \
+             "[-missing_first] [-dump] [-cols] [-count] [-rejects] [-mem_limit] [-print_col_type] [-print_col_idx] [-is_missing_idx] [-print_row] [-find] " \
+             "[-sort_by] [-join] [-approx_distinct] [-approx_quantile]\n" \
              "\n" \
              "\t-f [filename] must be the first argument\n" \
              "\t-from [uint] must come after -f option, if used\n" \
              "\t-len [uint] must come after -f option, and if -from is used, after -from\n" \
-             "\t only one of -print_col_type [uint] / -print_col_idx [uint] [uint] / -is_missing_idx [uint] [uint] can be used\n" \
+             "\t-index [filename] cannot be used with -from or -len, " \
+             "and leaves out a last line without '\\n'\n" \
+             "\t-row_from [uint] / -row_count [uint] must come after -f option, if used\n" \
+             "\t-col_index [filename] is only used by -find\n" \
+             "\t only one of -print_col_type [uint] / -print_col_idx [uint] [uint] / -is_missing_idx [uint] [uint] / " \
+             "-print_row [uint] / -find [uint] [value] / -sort_by [uint] [asc|desc] / " \
+             "-join [filename] [uint] [uint] / -approx_distinct [uint] / " \
+             "-approx_quantile [uint] [0..1] can be used\n" \
+             "\t-missing_first is only used by -sort_by, -dump by -find and -sort_by, -cols [uint,...] by -dump\n" \
+             "\t-count is only used by -find and -join\n" \
+             "\t-mem_limit [uint] cannot be used with -index, -col_index, -sort_by or -join\n" \
              "\n" \
              "Only one option of each kind can be used.\n";
 
 
+/**
+ * Answers the query asked for by reading the file one window at a time, each window being
+ * released before the next one is mapped, so that the memory used stays within a limit.
+ * The answers are the same as when the whole file is mapped.
+ *
+ * @param fd the file descriptor of the file.
+ * @param file_size the size of the file.
+ * @param mem_limit the number of bytes to use at most.
+ * @param from the byte to start reading from, as given by -from.
+ * @param len the number of bytes to read, as given by -len.
+ * @param row_from the first row to read.
+ * @param row_count the number of rows to read.
+ * @param query the query asked for, with -rejects every line given by -from and -len is read.
+ */
+void run_windowed(int fd, size_t file_size, size_t mem_limit, size_t from, size_t len,
+                  size_t row_from, size_t row_count, Query *query) {
+    WindowScanner *scanner = new WindowScanner(fd, file_size, mem_limit);
+
+    // Parse the schema from the first lines of the file, window by window
+    TypesArray *schema = new TypesArray();
+    size_t rows_left = SCHEMA_ROWS;
+    size_t pos = 0;
+    while (rows_left > 0 && scanner->map(pos, file_size)) {
+        rows_left -= merge_schema(scanner->window_, 0, scanner->window_len_, schema, rows_left);
+        pos += scanner->window_len_;
+    }
+    scanner->release();
+
+    // discard the first line if given from != 0 and the last one if cut by len
+    size_t end = from + len < from ? SIZE_MAX : from + len;
+    if (from != 0) {
+        from = scanner->next_line(from);
+    }
+    if (end >= file_size) {
+        end = file_size;
+    } else {
+        end = scanner->line_end(end, from);
+    }
+
+    query->start(schema, query->rejects_ ? scanner->count_lines(from) + 1 : 1);
+    RejectReport *report = query->report_;
+    if (!report && (!query->needs_rows() || (query->find_asked_ && !query->find_possible_))) {
+        end = from;
+    }
+    size_t last_row = row_from + row_count < row_from ? SIZE_MAX : row_from + row_count;
+    // the index among the valid rows of the first row of the window
+    size_t row = 0;
+    bool done = false;
+    pos = from;
+    // the rejects are reported from every line, even those past the rows asked for
+    while ((report || (!done && row < last_row)) && scanner->map(pos, end)) {
+        char *window = scanner->window_;
+        size_t window_end = std::min(scanner->window_len_, end - pos);
+        FieldArray *rows = new FieldArray();
+        FieldArray **columnar = make_columnar(window, 0, window_end, schema, nullptr, rows,
+                                              query->needed_, report);
+        size_t num_rows = rows->len();
+        if (!done && row < last_row && row + num_rows > row_from) {
+            size_t k = row < row_from ? row_from - row : 0;
+            size_t k_end = std::min(num_rows, last_row - row);
+            done = query->scan(window, columnar, rows, 0, k, k_end - k, row + k - row_from);
+        }
+        row += num_rows;
+        delete_columnar(columnar, schema->len());
+        delete rows;
+        // the results of this window are written before it is released
+        std::cout.flush();
+        pos += scanner->window_len_;
+    }
+    query->finish();
+    delete schema;
+    delete scanner;
+}
+
+
 int main(int argc, char **argv) {
     //TODO: move parsing logic to its own class
 
     // Assert valid arguments given
-    if (argc < 5 || argc > 10) {
+    if (argc < 5 || argc > 27) {
         std::cout << USAGE;
         return 0;
     }
@@ -56,6 +181,20 @@ int main(int argc, char **argv) {
     char *filename = nullptr;
     char *len_arg = nullptr;
     char *from_arg = nullptr;
+    char *index_arg = nullptr;
+    char *row_from_arg = nullptr;
+    char *row_count_arg = nullptr;
+    char *col_index_arg = nullptr;
+    char *find_value = nullptr;
+    char *mem_limit_arg = nullptr;
+    char *cols_arg = nullptr;
+    char *join_file = nullptr;
+    char *quantile_arg = nullptr;
+    bool count = false;
+    bool rejects = false;
+    bool descending = false;
+    bool missing_first = false;
+    bool dump = false;
     char *output_arg = nullptr;
     char *uint1_arg = nullptr;
     char *uint2_arg = nullptr;
@@ -72,7 +211,63 @@ int main(int argc, char **argv) {
         } else if (strcmp(argv[i], "-len") == 0 && !len_arg && argc > i + 1) {
             len_arg = argv[i + 1];
             i += 2;
-        } else if (strcmp(argv[i], "-print_col_type") == 0 && !output_arg && argc > i + 1) {
+        } else if (strcmp(argv[i], "-index") == 0 && !index_arg && argc > i + 1) {
+            index_arg = argv[i + 1];
+            i += 2;
+        } else if (strcmp(argv[i], "-row_from") == 0 && !row_from_arg && argc > i + 1) {
+            row_from_arg = argv[i + 1];
+            i += 2;
+        } else if (strcmp(argv[i], "-row_count") == 0 && !row_count_arg && argc > i + 1) {
+            row_count_arg = argv[i + 1];
+            i += 2;
+        } else if (strcmp(argv[i], "-col_index") == 0 && !col_index_arg && argc > i + 1) {
+            col_index_arg = argv[i + 1];
+            i += 2;
+        } else if (strcmp(argv[i], "-find") == 0 && !output_arg && argc > i + 2) {
+            output_arg = argv[i];
+            uint1_arg = argv[i + 1];
+            find_value = argv[i + 2];
+            i += 3;
+        } else if (strcmp(argv[i], "-sort_by") == 0 && !output_arg && argc > i + 1) {
+            output_arg = argv[i];
+            uint1_arg = argv[i + 1];
+            i += 2;
+            if (i < argc && (strcmp(argv[i], "asc") == 0 || strcmp(argv[i], "desc") == 0)) {
+                descending = strcmp(argv[i], "desc") == 0;
+                i += 1;
+            }
+        } else if (strcmp(argv[i], "-mem_limit") == 0 && !mem_limit_arg && argc > i + 1) {
+            mem_limit_arg = argv[i + 1];
+            i += 2;
+        } else if (strcmp(argv[i], "-cols") == 0 && !cols_arg && argc > i + 1) {
+            cols_arg = argv[i + 1];
+            i += 2;
+        } else if (strcmp(argv[i], "-join") == 0 && !output_arg && argc > i + 3) {
+            output_arg = argv[i];
+            join_file = argv[i + 1];
+            uint1_arg = argv[i + 2];
+            uint2_arg = argv[i + 3];
+            i += 4;
+        } else if (strcmp(argv[i], "-approx_quantile") == 0 && !output_arg && argc > i + 2) {
+            output_arg = argv[i];
+            uint1_arg = argv[i + 1];
+            quantile_arg = argv[i + 2];
+            i += 3;
+        } else if (strcmp(argv[i], "-rejects") == 0 && !rejects) {
+            rejects = true;
+            i += 1;
+        } else if (strcmp(argv[i], "-count") == 0 && !count) {
+            count = true;
+            i += 1;
+        } else if (strcmp(argv[i], "-missing_first") == 0 && !missing_first) {
+            missing_first = true;
+            i += 1;
+        } else if (strcmp(argv[i], "-dump") == 0 && !dump) {
+            dump = true;
+            i += 1;
+        } else if ((strcmp(argv[i], "-print_col_type") == 0 || strcmp(argv[i], "-print_row") == 0
+                    || strcmp(argv[i], "-approx_distinct") == 0)
+                   && !output_arg && argc > i + 1) {
             output_arg = argv[i];
             uint1_arg = argv[i + 1];
             i += 2;
@@ -97,6 +292,15 @@ int main(int argc, char **argv) {
     if (!output_arg) {
         return 0;
     }
+    if (index_arg && (from_arg || len_arg)) {
+        std::cout << USAGE;
+        return -1;
+    }
+    if (mem_limit_arg && (index_arg || col_index_arg || strcmp(output_arg, "-sort_by") == 0
+                          || strcmp(output_arg, "-join") == 0)) {
+        std::cout << USAGE;
+        return -1;
+    }
 
     // Parse the numeric arguments
     size_t len = SIZE_MAX;
@@ -109,6 +313,16 @@ int main(int argc, char **argv) {
         from = parse_uint(from_arg);
         assert(from != SIZE_MAX);
     }
+    size_t row_from = 0;
+    if (row_from_arg) {
+        row_from = parse_uint(row_from_arg);
+        assert(row_from != SIZE_MAX);
+    }
+    size_t row_count = SIZE_MAX;
+    if (row_count_arg) {
+        row_count = parse_uint(row_count_arg);
+        assert(row_count != SIZE_MAX);
+    }
     size_t uint1 = 0;
     if (uint1_arg) {
         uint1 = parse_uint(uint1_arg);
@@ -119,6 +333,29 @@ int main(int argc, char **argv) {
         uint2 = parse_uint(uint2_arg);
         assert(uint2 != SIZE_MAX);
     }
+    size_t mem_limit = 0;
+    if (mem_limit_arg) {
+        mem_limit = parse_uint(mem_limit_arg);
+        assert(mem_limit != SIZE_MAX);
+    }
+    double quantile = 0;
+    if (quantile_arg) {
+        char *quantile_end;
+        quantile = strtod(quantile_arg, &quantile_end);
+        assert(quantile_end != quantile_arg && *quantile_end == '\0');
+        assert(quantile >= 0 && quantile <= 1);
+    }
+    // delimit the value to find like a field so it is read like one
+    char *value = nullptr;
+    size_t value_len = 0;
+    if (find_value) {
+        value_len = strlen(find_value);
+        value = new char[value_len + 3];
+        value[0] = '<';
+        memcpy(&value[1], find_value, value_len);
+        value[value_len + 1] = '>';
+        value[value_len + 2] = '\0';
+    }
 
 
     // Make sure the file exists/can be opened
@@ -131,6 +368,23 @@ int main(int argc, char **argv) {
     size_t file_size = st.st_size;
 
     assert(from < file_size);
+    // the index keeps byte offsets as int, past which they would wrap
+    if (index_arg && file_size > INT_MAX) {
+        std::cerr << "Cannot index a file larger than " << INT_MAX << " bytes\n";
+        delete[] value;
+        close(fd);
+        return -1;
+    }
+
+    Query *query = new Query(output_arg, uint1, uint2, value, value_len, dump, cols_arg, count,
+                             quantile, rejects);
+    if (mem_limit_arg) {
+        run_windowed(fd, file_size, mem_limit, from, len, row_from, row_count, query);
+        delete query;
+        delete[] value;
+        close(fd);
+        return 0;
+    }
 
     // Get the number of page sizes we need
     int pg_size = getpagesize();
@@ -140,57 +394,221 @@ int main(int argc, char **argv) {
     //Mmap for lazy read
     char *file = (char *) mmap(nullptr, ask, PROT_READ, MAP_PRIVATE, fd, 0);
 
-    // Parse the schema
-    TypesArray *schema = parse_schema(file);
+    bool print_row_asked = strcmp(output_arg, "-print_row") == 0;
+    bool find_asked = strcmp(output_arg, "-find") == 0;
+    bool sort_asked = strcmp(output_arg, "-sort_by") == 0;
+    bool join_asked = strcmp(output_arg, "-join") == 0;
+    // writing rows needs to know where they are
+    bool rows_written = (dump && !count) || (join_asked && !count);
+    bool rows_asked = print_row_asked || row_from_arg || row_count_arg;
+    TypesArray *schema = nullptr;
+    FieldArray **columnar = nullptr;
+    FieldArray *rows = nullptr;
+    // index of the first row of the columnar among the rows
+    size_t columnar_row = 0;
+    // the portion of the file the columnar is made from
+    size_t end = file_size;
+    SorIndex *index = nullptr;
+    ColumnIndex *col_index = nullptr;
+    bool col_indexed = false;
+    // the report still to be filled by the first scan of the whole portion of the file
+    RejectReport *scan_report = nullptr;
+    if (index_arg) {
+        // Only parse what was appended since the index was saved, only read the columns
+        // the query needs and only save the index again if it changed, the index then
+        // owns the schema, the columnar and the rows
+        index = new SorIndex();
+        index->load(index_arg);
+        bool changed = index->update(file, file_size, st.st_ino, file_mtime(&st));
+        bool *index_needed = query->columns_needed(index->schema_->len());
+        bool rows_read = print_row_asked || rows_written;
+        changed = !index->read(index_arg, file, index_needed, rows_read, rejects) || changed;
+        delete[] index_needed;
+        if (changed && !index->save(index_arg)) {
+            std::cerr << "Could not write index file " << index_arg << "\n";
+        }
+        schema = index->schema_;
+        columnar = index->columnar_;
+        rows = rows_read ? index->rows_ : nullptr;
+        end = index->indexed_end_;
+        query->start(schema, 1);
+        if (query->report_) {
+            // the index keeps the rows it rejected
+            query->report_->add_rejected(file, index->rejected_);
+        }
+    } else {
+        // Parse the schema
+        schema = parse_schema(file);
 
-    // discard the first line if given from != 0
-    size_t end = from + len;
-    if (from != 0 && from < file_size) {
-        while (file[from] != '\n') {
-            assert(file[from] != EOF);
-            ++from;
+        // discard the first line if given from != 0 and the last one if cut by len
+        trim_range(file, file_size, from, len, &from, &end);
+        query->start(schema, rejects ? count_lines(file, from) + 1 : 1);
+        scan_report = query->report_;
+
+        if (rows_asked) {
+            // Find where every valid row starts without building the columnar
+            rows = make_row_index(file, from, end, schema, scan_report);
+            scan_report = nullptr;
+            if (row_from < rows->len()) {
+                from = rows->get_start(row_from);
+            } else {
+                from = end;
+            }
+            if (row_from < rows->len() && row_count < rows->len() - row_from) {
+                end = rows->get_end(row_from + row_count - 1);
+            }
+            columnar_row = row_from;
         }
-        ++from;
+
     }
-    // if the file size is smaller than the bytes we are supposed to read,
-    // we just read the whole file
-    if (end >= file_size) {
-        end = file_size;
-    } else {
-        // else we discard the last line
-        while (file[end] != '\n') {
-            assert(end > from);
-            --end;
+
+    bool *needed = query->needed_;
+    if (find_asked && col_index_arg) {
+        // A column index saved from the same portion of the same file
+        // answers without building the columnar
+        col_index = new ColumnIndex();
+        col_indexed = col_index->load(col_index_arg)
+                      && col_index->matches(file, file_size, st.st_ino, file_mtime(&st),
+                                            from, end, uint1);
+    }
+
+    // Get the data requested by -from and -len and the rows requested by
+    // -row_from and -row_count and put them into columnar form
+    if (!index && !print_row_asked && !col_indexed) {
+        if (rows_written && !rows) {
+            rows = new FieldArray();
         }
+        columnar = make_columnar(file, from, end, schema, nullptr, rows_asked ? nullptr : rows,
+                                 needed, scan_report);
+        scan_report = nullptr;
+    }
+    if (rows_written && !rows) {
+        rows = make_row_index(file, from, end, schema, scan_report);
+        scan_report = nullptr;
+    }
+    // validate the rows no query needed
+    if (scan_report) {
+        append_columnar(file, from, end, schema, nullptr, nullptr, nullptr, SIZE_MAX, scan_report);
     }
+    // index of the first row asked for in the columnar
+    size_t first_row = row_from - columnar_row;
 
-    // Get the data requested by -from and -len and
-    // put them into columnar form
-    FieldArray **columnar = make_columnar(file, from, end, schema);
+    // Determine what the user asked and do it, -find without -col_index scans the column
+    if (find_asked && col_index_arg) {
+        FieldArray *found = new FieldArray();
+        if (col_indexed && query->find_possible_
+            && !col_index->lookup(file, value, 0, value_len + 1, found)) {
+            // a damaged index file is built again instead of answering with no rows
+            std::cerr << "Could not read column index file " << col_index_arg << "\n";
+            col_indexed = false;
+            // with -index it is built again from the column the index holds
+            if (!index) {
+                columnar = make_columnar(file, from, end, schema, nullptr, nullptr, needed);
+            }
+        }
+        if (!col_indexed) {
+            col_index->build(file, file_size, st.st_ino, file_mtime(&st), from, end, uint1,
+                             columnar[uint1]);
+            if (!col_index->save(col_index_arg)) {
+                std::cerr << "Could not write column index file " << col_index_arg << "\n";
+            }
+            if (query->find_possible_) {
+                col_index->lookup(file, value, 0, value_len + 1, found);
+            }
+        }
+        for (size_t k = 0; k < found->len(); ++k) {
+            size_t row = found->get_start(k);
+            if (row >= first_row && row - first_row < row_count) {
+                query->found(file, rows, columnar_row, row, row - first_row);
+            }
+        }
+        delete found;
+    } else if (join_asked) {
+        // Map the other file and put its key column into columnar form
+        int other_fd = open(join_file, O_RDONLY);
+        assert(other_fd != -1);
+        struct stat other_st;
+        fstat(other_fd, &other_st);
+        size_t other_size = other_st.st_size;
+        size_t other_ask = (size_t) (other_size / pg_size + 1) * pg_size;
+        char *other = (char *) mmap(nullptr, other_ask, PROT_READ, MAP_PRIVATE, other_fd, 0);
+        TypesArray *other_schema = parse_schema(other);
+        assert(uint2 < other_schema->len());
+        bool *other_needed = new bool[other_schema->len()]();
+        other_needed[uint2] = true;
+        FieldArray *other_rows = count ? nullptr : new FieldArray();
+        FieldArray **other_columnar = make_columnar(other, 0, other_size, other_schema, nullptr,
+                                                    other_rows, other_needed);
 
-    // Determine what the user asked and do it
-    if (strcmp(output_arg, "-print_col_type") == 0) {
-        print_type(schema->get(uint1));
-    } else {
-        size_t field_start = columnar[uint1]->get_start(uint2);
-        size_t field_end = columnar[uint1]->get_end(uint2);
-        if (strcmp(output_arg, "-is_missing_idx") == 0) {
-            if (field_end - field_start < 2) {
-                std::cout << 1 << '\n';
+        FieldArray *pairs = hash_join(file, columnar[uint1], other, other_columnar[uint2]);
+        size_t matched = 0;
+        for (size_t k = 0; k < pairs->len(); ++k) {
+            size_t row = pairs->get_start(k);
+            if (row >= first_row && row - first_row < row_count) {
+                ++matched;
+                if (!count) {
+                    dump_joined_row(file, rows->get_start(row + columnar_row),
+                                    rows->get_end(row + columnar_row), other,
+                                    other_rows->get_start(pairs->get_end(k)),
+                                    other_rows->get_end(pairs->get_end(k)));
+                }
+            }
+        }
+        if (count) {
+            std::cout << matched << '\n';
+        }
+        delete pairs;
+        delete_columnar(other_columnar, other_schema->len());
+        delete other_rows;
+        delete[] other_needed;
+        delete other_schema;
+        munmap(other, other_ask);
+        close(other_fd);
+    } else if (sort_asked) {
+        FieldArray *column = columnar[uint1];
+        size_t num_rows = 0;
+        if (first_row < column->len()) {
+            num_rows = std::min(row_count, column->len() - first_row);
+        }
+        size_t *sorted = sort_column(file, column, first_row, num_rows, descending,
+                                     missing_first);
+        for (size_t k = 0; k < num_rows; ++k) {
+            if (dump) {
+                dump_row(file, rows->get_start(sorted[k] + columnar_row),
+                         rows->get_end(sorted[k] + columnar_row), query->dump_cols_);
             } else {
-                std::cout << 0 << '\n';
+                std::cout << sorted[k] - first_row << '\n';
             }
+        }
+        delete[] sorted;
+    } else if (query->needs_rows()) {
+        // the rows of the columnar, or of the row table alone, the query is given
+        size_t held = 0;
+        if (print_row_asked) {
+            held = rows->len() > columnar_row ? rows->len() - columnar_row : 0;
         } else {
-            print_field(file, field_start, field_end, schema->get(uint1));
+            held = columnar[uint1]->len();
+        }
+        size_t num_rows = 0;
+        if (first_row < held) {
+            num_rows = std::min(row_count, held - first_row);
         }
+        query->scan(file, columnar, rows, columnar_row, first_row, num_rows, 0);
     }
+    query->finish();
     // delete everything
-	size_t num_col = schema->len();
-    for (size_t k = 0; k < num_col; ++k) {
-        delete columnar[k];
+    delete query;
+    delete[] value;
+    delete col_index;
+    if (index) {
+        delete index;
+    } else {
+        if (columnar) {
+            delete_columnar(columnar, schema->len());
+        }
+        delete rows;
+        delete schema;
     }
-    delete[] columnar;
-    delete schema;
     munmap(file, ask);
     close(fd);
     return 0;
@@ -0,0 +1,258 @@
+//lang::Cpp
+
+
+/**
+ * Query: Answers the query asked for on the rows of a .sor file, range by range
+ *
+ * Author: cao.yuan1@husky.neu.edu & zhan.d@husky.neu.edu
+ */
+
+
+#pragma once
+
+
+#include <cassert>
+#include <cstring>
+#include <iostream>
+
+
+#include "object.h"
+#include "field_array.h"
+#include "helper.h"
+#include "reject_report.h"
+#include "sketch.h"
+#include "types.h"
+#include "types_array.h"
+
+
+/**
+ * Query: represents the query asked for on the command line and what it found so far.
+ * The rows asked for are given to it range by range, either all at once when the whole
+ * file is mapped or one window at a time, so both ways give the same answers.
+ * A row is known by its index among the rows asked for, the first one being 0.
+ */
+class Query : public Object {
+
+public:
+    char* output_arg_; // the query asked for (external)
+    size_t uint1_; // the first argument of the query
+    size_t uint2_; // the second argument of the query
+    char* value_; // the value delimited like a field asked for by -find (external)
+    size_t value_len_; // the length of the value
+    bool dump_; // whether to write the rows found instead of their index
+    char* cols_arg_; // the columns to write when dumping rows, null for all (external)
+    bool count_; // whether to write the number of rows found instead of the rows
+    double quantile_; // the rank asked for by -approx_quantile
+    bool rejects_; // whether to report the rows that do not match the schema
+    bool type_asked_; // whether -print_col_type was asked for
+    bool print_row_asked_; // whether -print_row was asked for
+    bool find_asked_; // whether -find was asked for
+    bool idx_asked_; // whether -print_col_idx or -is_missing_idx was asked for
+    TypesArray* schema_; // the schema of the file (external)
+    bool* needed_; // the columns the query needs (owned)
+    bool* dump_cols_; // the columns to write when dumping rows, null for all (owned)
+    bool find_possible_; // whether the value asked for by -find can be in the column
+    HyperLogLog* distinct_; // the sketch of -approx_distinct, null if not asked (owned)
+    QuantileSketch* quantiles_; // the sketch of -approx_quantile, null if not asked (owned)
+    RejectReport* report_; // the report of -rejects, null if not asked (owned)
+    size_t matched_; // the number of rows found
+    bool answered_; // whether the single row asked for was found
+
+    /**
+     * Constructs the query asked for on the command line.
+     * @param output_arg the query asked for.
+     * @param uint1 the first argument of the query.
+     * @param uint2 the second argument of the query.
+     * @param value the value delimited like a field asked for by -find.
+     * @param value_len the length of the value.
+     * @param dump whether to write the rows found instead of their index.
+     * @param cols_arg the columns to write when dumping rows, null for all of them.
+     * @param count whether to write the number of rows found instead of the rows.
+     * @param quantile the rank asked for by -approx_quantile.
+     * @param rejects whether to report the rows that do not match the schema.
+     */
+    Query(char* output_arg, size_t uint1, size_t uint2, char* value, size_t value_len,
+          bool dump, char* cols_arg, bool count, double quantile, bool rejects) : Object() {
+        this->output_arg_ = output_arg;
+        this->uint1_ = uint1;
+        this->uint2_ = uint2;
+        this->value_ = value;
+        this->value_len_ = value_len;
+        this->dump_ = dump;
+        this->cols_arg_ = cols_arg;
+        this->count_ = count;
+        this->quantile_ = quantile;
+        this->rejects_ = rejects;
+        this->type_asked_ = strcmp(output_arg, "-print_col_type") == 0;
+        this->print_row_asked_ = strcmp(output_arg, "-print_row") == 0;
+        this->find_asked_ = strcmp(output_arg, "-find") == 0;
+        this->idx_asked_ = strcmp(output_arg, "-print_col_idx") == 0
+                           || strcmp(output_arg, "-is_missing_idx") == 0;
+        this->schema_ = nullptr;
+        this->needed_ = nullptr;
+        this->dump_cols_ = nullptr;
+        this->find_possible_ = false;
+        this->distinct_ = nullptr;
+        this->quantiles_ = nullptr;
+        this->report_ = nullptr;
+        this->matched_ = 0;
+        this->answered_ = false;
+    }
+
+    /**
+     * Default destructor.
+     */
+    virtual ~Query() {
+        delete[] this->needed_;
+        delete[] this->dump_cols_;
+        delete this->distinct_;
+        delete this->quantiles_;
+        delete this->report_;
+    }
+
+    /**
+     * Prepares the query for a file once its schema is known, and answers -print_col_type.
+     * @param schema the schema of the file.
+     * @param first_line the line the rows asked for start at, for -rejects.
+     */
+    virtual void start(TypesArray* schema, size_t first_line) {
+        this->schema_ = schema;
+        if (this->cols_arg_) {
+            this->dump_cols_ = parse_projection(this->cols_arg_, schema->len());
+            assert(this->dump_cols_);
+        }
+        this->needed_ = this->columns_needed(schema->len());
+        // a value of a less restrictive type than the column cannot be in it
+        this->find_possible_ = this->find_asked_
+                               && parse_field_type(this->value_, 0, this->value_len_ + 1)
+                                  <= schema->get(this->uint1_);
+        if (strcmp(this->output_arg_, "-approx_distinct") == 0) {
+            this->distinct_ = new HyperLogLog();
+        } else if (strcmp(this->output_arg_, "-approx_quantile") == 0) {
+            assert(schema->get(this->uint1_) != Types::STRING);
+            this->quantiles_ = new QuantileSketch(0);
+        }
+        if (this->rejects_) {
+            this->report_ = new RejectReport(first_line);
+        }
+        if (this->type_asked_) {
+            print_type(schema->get(this->uint1_));
+        }
+    }
+
+    /**
+     * Determines which columns the query needs, so that only those are built or read.
+     * @param width the number of columns of the schema.
+     * @return for each column whether it is needed (owned by the caller).
+     */
+    virtual bool* columns_needed(size_t width) {
+        // only the column the query is about
+        bool* needed = new bool[width]();
+        if (!this->type_asked_ && !this->print_row_asked_) {
+            assert(this->uint1_ < width);
+            needed[this->uint1_] = true;
+        }
+        return needed;
+    }
+
+    /**
+     * Determines whether the query is answered from the rows asked for.
+     * @return false if it is answered from the schema alone.
+     */
+    virtual bool needs_rows() {
+        return !this->type_asked_;
+    }
+
+    /**
+     * Answers the query for a range of consecutive rows asked for.
+     *
+     * @param file the file the rows are in.
+     * @param columnar the columnar representation holding the rows, with at least the
+     *                 columns the query needs.
+     * @param rows the row table, row k of the columnar being row k + rows_offset of it.
+     * @param rows_offset the row of the row table of the first row of the columnar.
+     * @param first the row of the columnar the range starts at.
+     * @param num_rows the number of rows in the range.
+     * @param asked the index among the rows asked for of the first row of the range.
+     * @return whether the query is answered, so that no more rows are needed.
+     */
+    virtual bool scan(char* file, FieldArray** columnar, FieldArray* rows, size_t rows_offset,
+                      size_t first, size_t num_rows, size_t asked) {
+        if (this->print_row_asked_ || this->idx_asked_) {
+            size_t target = this->print_row_asked_ ? this->uint1_ : this->uint2_;
+            if (target < asked || target - asked >= num_rows) {
+                return this->answered_;
+            }
+            size_t k = first + target - asked;
+            if (this->print_row_asked_) {
+                print_row(file, rows->get_start(k + rows_offset), this->schema_);
+            } else {
+                size_t field_start = columnar[this->uint1_]->get_start(k);
+                size_t field_end = columnar[this->uint1_]->get_end(k);
+                if (strcmp(this->output_arg_, "-is_missing_idx") == 0) {
+                    if (field_end - field_start < 2) {
+                        std::cout << 1 << '\n';
+                    } else {
+                        std::cout << 0 << '\n';
+                    }
+                } else {
+                    print_field(file, field_start, field_end, this->schema_->get(this->uint1_));
+                }
+            }
+            this->answered_ = true;
+        } else if (this->find_possible_) {
+            FieldArray* column = columnar[this->uint1_];
+            for (size_t k = first; k < first + num_rows; ++k) {
+                if (field_equals(file, column->get_start(k), column->get_end(k),
+                                 this->value_, 0, this->value_len_ + 1, column->type_)) {
+                    this->found(file, rows, rows_offset, k, asked + k - first);
+                }
+            }
+        } else if ((this->distinct_ || this->quantiles_) && num_rows > 0) {
+            sketch_column(file, columnar[this->uint1_], first, num_rows, this->distinct_,
+                          this->quantiles_);
+        }
+        return this->answered_;
+    }
+
+    /**
+     * Writes a row found by -find, or only counts it with -count.
+     * @param file the file the row is in.
+     * @param rows the row table, row k of the columnar being row k + rows_offset of it.
+     * @param rows_offset the row of the row table of the first row of the columnar.
+     * @param row the row of the columnar found.
+     * @param asked its index among the rows asked for.
+     */
+    virtual void found(char* file, FieldArray* rows, size_t rows_offset, size_t row,
+                       size_t asked) {
+        ++this->matched_;
+        if (this->count_) {
+            // only the number of rows found is written
+        } else if (this->dump_) {
+            dump_row(file, rows->get_start(row + rows_offset), rows->get_end(row + rows_offset),
+                     this->dump_cols_);
+        } else {
+            std::cout << asked << '\n';
+        }
+    }
+
+    /**
+     * Writes what is only known once every row asked for was given, then the report of
+     * the rejected rows.
+     */
+    virtual void finish() {
+        // the single row asked for must exist
+        assert(!(this->print_row_asked_ || this->idx_asked_) || this->answered_);
+        if (this->find_asked_ && this->count_) {
+            std::cout << this->matched_ << '\n';
+        } else if (this->distinct_) {
+            std::cout << this->distinct_->estimate() << '\n';
+        } else if (this->quantiles_ && this->quantiles_->count_ > 0) {
+            print_quantile(this->quantiles_->quantile(this->quantile_),
+                           this->schema_->get(this->uint1_));
+        }
+        if (this->report_) {
+            this->report_->print();
+        }
+    }
+};
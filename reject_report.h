@@ -0,0 +1,101 @@
+//lang::Cpp
+
+
+/**
+ * RejectReport: Counts the rows of a .sor file that do not match its schema
+ *
+ * Author: cao.yuan1@husky.neu.edu & zhan.d@husky.neu.edu
+ */
+
+
+#pragma once
+
+
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+
+#include "object.h"
+#include "field_array.h"
+
+
+// the number of rejected rows whose line is reported
+const size_t REJECT_SAMPLES = 10;
+
+
+/**
+ * RejectReport: represents the rows rejected while reading a file, their number and the
+ * line of the first few of them. Lines are numbered from 1, blank lines included.
+ */
+class RejectReport : public Object {
+
+public:
+    size_t count_; // the number of rows rejected
+    size_t num_samples_; // the number of lines in samples_
+    size_t samples_[REJECT_SAMPLES]; // the lines of the first rows rejected
+    size_t line_; // the line being read
+
+    /**
+     * Constructs an empty report.
+     * @param first_line the line reading starts at.
+     */
+    RejectReport(size_t first_line) : Object() {
+        this->count_ = 0;
+        this->num_samples_ = 0;
+        this->line_ = first_line;
+    }
+
+    /**
+     * Default destructor.
+     */
+    virtual ~RejectReport() {}
+
+    /**
+     * Records that the line being read was rejected.
+     */
+    virtual void reject() {
+        if (this->num_samples_ < REJECT_SAMPLES) {
+            this->samples_[this->num_samples_++] = this->line_;
+        }
+        ++this->count_;
+    }
+
+    /**
+     * Records rows rejected earlier, the way an index keeps them.
+     * @param file the file the rows are in.
+     * @param rejected the starting and ending bytes of the rows, in the order of the file.
+     */
+    virtual void add_rejected(char* file, FieldArray* rejected) {
+        // only the lines of the samples are counted
+        size_t pos = 0;
+        size_t line = 1;
+        for (size_t k = 0; k < rejected->len() && this->num_samples_ < REJECT_SAMPLES; ++k) {
+            size_t start = rejected->get_start(k);
+            while (pos < start) {
+                char* newline = (char*) memchr(&file[pos], '\n', start - pos);
+                if (!newline) {
+                    break;
+                }
+                ++line;
+                pos = newline - file + 1;
+            }
+            this->samples_[this->num_samples_++] = line;
+        }
+        this->count_ += rejected->len();
+    }
+
+    /**
+     * Writes this report to std err.
+     */
+    virtual void print() {
+        std::cerr << "rejected rows: " << this->count_ << "\n";
+        if (this->num_samples_ > 0) {
+            std::cerr << "first rejected lines:";
+            for (size_t i = 0; i < this->num_samples_; ++i) {
+                std::cerr << " " << this->samples_[i];
+            }
+            std::cerr << "\n";
+        }
+    }
+};
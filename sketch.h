@@ -0,0 +1,416 @@
+//lang::Cpp
+
+
+/**
+ * Approximate answers about a column of a .sor file in small constant memory
+ *
+ * Author: cao.yuan1@husky.neu.edu & zhan.d@husky.neu.edu
+ */
+
+
+#pragma once
+
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <thread>
+
+
+#include "object.h"
+#include "field_array.h"
+#include "helper.h"
+#include "sort.h"
+#include "types.h"
+
+
+// the number of bits of a hash that choose its register, 2^14 registers give a 0.8% error
+const size_t HLL_PRECISION = 14;
+
+// the number of items the top level of a quantile sketch holds, 200 give about a 1.7% error
+const size_t KLL_K = 200;
+
+// the maximum number of levels of a quantile sketch, enough for 2^64 values
+const size_t KLL_MAX_LEVELS = 64;
+
+
+/**
+ * Scrambles the bits of a hash so that every bit of the result depends on all of them,
+ * the bits of an FNV-1a hash alone are not spread evenly enough to be counted.
+ * @param h the hash.
+ * @return the scrambled hash.
+ */
+inline uint64_t mix_hash(uint64_t h) {
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+
+/**
+ * HyperLogLog: counts the distinct values it is given, approximately, in a fixed number of
+ * registers. Each register keeps the longest run of leading zeros among the hashes that
+ * fall in it. Sketches of different values can be merged.
+ */
+class HyperLogLog : public Object {
+
+public:
+    size_t num_registers_; // the number of registers
+    uint8_t* registers_; // the longest run of leading zeros of each register, plus 1 (owned)
+
+    /**
+     * Default constructor, an empty sketch.
+     */
+    HyperLogLog() : Object() {
+        this->num_registers_ = (size_t) 1 << HLL_PRECISION;
+        this->registers_ = new uint8_t[this->num_registers_]();
+    }
+
+    /**
+     * Default destructor.
+     */
+    virtual ~HyperLogLog() {
+        delete[] this->registers_;
+    }
+
+    /**
+     * Adds a value to this sketch.
+     * @param hash the hash of the value.
+     */
+    virtual void add(size_t hash) {
+        uint64_t h = mix_hash(hash);
+        size_t reg = h >> (64 - HLL_PRECISION);
+        // the remaining bits, with a 1 past them so the run of zeros ends
+        uint64_t rest = (h << HLL_PRECISION) | ((uint64_t) 1 << (HLL_PRECISION - 1));
+        uint8_t rank = __builtin_clzll(rest) + 1;
+        if (rank > this->registers_[reg]) {
+            this->registers_[reg] = rank;
+        }
+    }
+
+    /**
+     * Adds the values of another sketch to this one.
+     * @param other the other sketch.
+     */
+    virtual void merge(HyperLogLog* other) {
+        for (size_t i = 0; i < this->num_registers_; ++i) {
+            if (other->registers_[i] > this->registers_[i]) {
+                this->registers_[i] = other->registers_[i];
+            }
+        }
+    }
+
+    /**
+     * Returns the approximate number of distinct values added to this sketch.
+     * @return the estimate.
+     */
+    virtual size_t estimate() {
+        double m = (double) this->num_registers_;
+        double sum = 0;
+        size_t zeros = 0;
+        for (size_t i = 0; i < this->num_registers_; ++i) {
+            sum += std::ldexp(1.0, -this->registers_[i]);
+            if (this->registers_[i] == 0) {
+                ++zeros;
+            }
+        }
+        double alpha = 0.7213 / (1 + 1.079 / m);
+        double estimate = alpha * m * m / sum;
+        // few values leave registers empty, counting them is more precise
+        if (estimate <= 2.5 * m && zeros > 0) {
+            estimate = m * std::log(m / zeros);
+        }
+        return (size_t) (estimate + 0.5);
+    }
+};
+
+
+/**
+ * QuantileSketch: a KLL sketch, which keeps a sample of the values it is given from which
+ * the value at any rank can be found approximately. Values are kept in levels, a value of
+ * level h standing for 2^h of them. When the sketch is full a level is sorted and every
+ * other of its values, starting at random, is moved to the next level, so that the sketch
+ * keeps about 3 * KLL_K values whatever their number. Sketches can be merged.
+ */
+class QuantileSketch : public Object {
+
+public:
+    size_t num_levels_; // the number of levels in use
+    double* levels_[KLL_MAX_LEVELS]; // the values of each level (owned)
+    size_t sizes_[KLL_MAX_LEVELS]; // the number of values of each level
+    size_t capacities_[KLL_MAX_LEVELS]; // the number of values allocated for each level
+    size_t count_; // the number of values added
+    double min_; // the smallest value added
+    double max_; // the largest value added
+    uint64_t seed_; // the state of the coin choosing which values a compaction keeps
+
+    /**
+     * Constructs an empty sketch.
+     * @param seed the seed of the random choices of the sketch, sketches merged together
+     *             should not share one.
+     */
+    QuantileSketch(uint64_t seed) : Object() {
+        this->num_levels_ = 1;
+        for (size_t h = 0; h < KLL_MAX_LEVELS; ++h) {
+            this->levels_[h] = nullptr;
+            this->sizes_[h] = 0;
+            this->capacities_[h] = 0;
+        }
+        this->count_ = 0;
+        this->min_ = 0;
+        this->max_ = 0;
+        this->seed_ = mix_hash(seed) | 1;
+    }
+
+    /**
+     * Default destructor.
+     */
+    virtual ~QuantileSketch() {
+        for (size_t h = 0; h < KLL_MAX_LEVELS; ++h) {
+            delete[] this->levels_[h];
+        }
+    }
+
+    /**
+     * Adds a value to this sketch.
+     * @param value the value.
+     */
+    virtual void add(double value) {
+        if (this->count_ == 0 || value < this->min_) {
+            this->min_ = value;
+        }
+        if (this->count_ == 0 || value > this->max_) {
+            this->max_ = value;
+        }
+        ++this->count_;
+        this->push_(0, value);
+        this->compact_();
+    }
+
+    /**
+     * Adds the values of another sketch to this one.
+     * @param other the other sketch.
+     */
+    virtual void merge(QuantileSketch* other) {
+        if (other->count_ == 0) {
+            return;
+        }
+        if (this->count_ == 0 || other->min_ < this->min_) {
+            this->min_ = other->min_;
+        }
+        if (this->count_ == 0 || other->max_ > this->max_) {
+            this->max_ = other->max_;
+        }
+        this->count_ += other->count_;
+        this->num_levels_ = std::max(this->num_levels_, other->num_levels_);
+        for (size_t h = 0; h < other->num_levels_; ++h) {
+            for (size_t i = 0; i < other->sizes_[h]; ++i) {
+                this->push_(h, other->levels_[h][i]);
+            }
+        }
+        this->compact_();
+    }
+
+    /**
+     * Returns the approximate value at the given rank among the values added.
+     * @param q the rank, from 0 for the smallest value to 1 for the largest.
+     * @return the value, 0 if no value was added.
+     */
+    virtual double quantile(double q) {
+        if (this->count_ == 0) {
+            return 0;
+        }
+        if (q <= 0) {
+            return this->min_;
+        }
+        if (q >= 1) {
+            return this->max_;
+        }
+        size_t n = 0;
+        for (size_t h = 0; h < this->num_levels_; ++h) {
+            n += this->sizes_[h];
+        }
+        // each value with its weight, ordered by value
+        std::pair<double, uint64_t>* weighted = new std::pair<double, uint64_t>[n];
+        size_t k = 0;
+        uint64_t total = 0;
+        for (size_t h = 0; h < this->num_levels_; ++h) {
+            for (size_t i = 0; i < this->sizes_[h]; ++i) {
+                weighted[k++] = std::make_pair(this->levels_[h][i], (uint64_t) 1 << h);
+            }
+            total += this->sizes_[h] << h;
+        }
+        std::sort(weighted, weighted + n);
+        double target = q * total;
+        double result = this->max_;
+        uint64_t seen = 0;
+        for (size_t i = 0; i < n; ++i) {
+            seen += weighted[i].second;
+            if (seen >= target) {
+                result = weighted[i].first;
+                break;
+            }
+        }
+        delete[] weighted;
+        return result;
+    }
+
+    /**
+     * Returns the number of values a level can hold before it is compacted, which shrinks
+     * by 2/3 for each level below the top one.
+     * @param h the level.
+     * @return its capacity.
+     */
+    virtual size_t level_capacity_(size_t h) {
+        double capacity = KLL_K * std::pow(2.0 / 3.0, (double) (this->num_levels_ - 1 - h));
+        return std::max((size_t) 2, (size_t) std::ceil(capacity));
+    }
+
+    /**
+     * Adds a value to a level, growing it if it is full.
+     * @param h the level.
+     * @param value the value.
+     */
+    virtual void push_(size_t h, double value) {
+        if (this->sizes_[h] == this->capacities_[h]) {
+            size_t capacity = this->capacities_[h] == 0 ? 8 : this->capacities_[h] * 2;
+            double* grown = new double[capacity];
+            if (this->levels_[h]) {
+                memcpy(grown, this->levels_[h], this->sizes_[h] * sizeof(double));
+            }
+            delete[] this->levels_[h];
+            this->levels_[h] = grown;
+            this->capacities_[h] = capacity;
+        }
+        this->levels_[h][this->sizes_[h]++] = value;
+    }
+
+    /**
+     * Compacts the lowest full levels until this sketch holds no more values than its
+     * levels can.
+     */
+    virtual void compact_() {
+        while (true) {
+            size_t held = 0;
+            size_t capacity = 0;
+            for (size_t h = 0; h < this->num_levels_; ++h) {
+                held += this->sizes_[h];
+                capacity += this->level_capacity_(h);
+            }
+            if (held <= capacity) {
+                return;
+            }
+            for (size_t h = 0; h < this->num_levels_; ++h) {
+                if (this->sizes_[h] >= this->level_capacity_(h)) {
+                    this->compact_level_(h);
+                    break;
+                }
+            }
+        }
+    }
+
+    /**
+     * Moves every other value of a level, starting at random, to the next level.
+     * If the level holds an odd number of values its smallest one stays.
+     * @param h the level.
+     */
+    virtual void compact_level_(size_t h) {
+        assert(h + 1 < KLL_MAX_LEVELS);
+        if (h + 1 == this->num_levels_) {
+            ++this->num_levels_;
+        }
+        double* level = this->levels_[h];
+        size_t n = this->sizes_[h];
+        std::sort(level, level + n);
+        size_t kept = n % 2;
+        this->seed_ ^= this->seed_ << 13;
+        this->seed_ ^= this->seed_ >> 7;
+        this->seed_ ^= this->seed_ << 17;
+        for (size_t i = kept + (this->seed_ & 1); i < n; i += 2) {
+            this->push_(h + 1, level[i]);
+        }
+        this->sizes_[h] = kept;
+    }
+};
+
+
+/**
+ * Adds the non missing values of the given rows of a column to sketches in one parallel
+ * pass: each thread fills its own sketches from its own slice of the rows, which are then
+ * merged into the given ones.
+ *
+ * @param file the file we are working on.
+ * @param column the column.
+ * @param first the first row.
+ * @param count the number of rows.
+ * @param distinct the sketch of the distinct values, null if not asked for.
+ * @param quantiles the sketch of the quantiles, null if not asked for, only for a BOOL,
+ *                  INT or FLOAT column.
+ * MUTATION: the values are added to the sketches.
+ */
+inline void sketch_column(char* file, FieldArray* column, size_t first, size_t count,
+                          HyperLogLog* distinct, QuantileSketch* quantiles) {
+    Types type = column->type_;
+    assert(!quantiles || type != Types::STRING);
+    size_t threads = sort_threads(count);
+    size_t slice = (count + threads - 1) / threads;
+    HyperLogLog** thread_distinct = new HyperLogLog*[threads];
+    QuantileSketch** thread_quantiles = new QuantileSketch*[threads];
+    std::thread* workers = new std::thread[threads];
+    for (size_t t = 0; t < threads; ++t) {
+        thread_distinct[t] = distinct ? new HyperLogLog() : nullptr;
+        thread_quantiles[t] = quantiles ? new QuantileSketch(quantiles->seed_ + t + 1) : nullptr;
+        workers[t] = std::thread([=]() {
+            size_t end = first + std::min(count, (t + 1) * slice);
+            for (size_t row = first + std::min(count, t * slice); row < end; ++row) {
+                size_t value_start;
+                size_t value_end;
+                size_t field_start = column->get_start(row);
+                size_t field_end = column->get_end(row);
+                if (!field_value(file, field_start, field_end, type, &value_start, &value_end)) {
+                    continue;
+                }
+                if (thread_distinct[t]) {
+                    thread_distinct[t]->add(hash_field(file, field_start, field_end, type));
+                }
+                if (thread_quantiles[t]) {
+                    thread_quantiles[t]->add((double) strtold(&file[value_start], nullptr));
+                }
+            }
+        });
+    }
+    for (size_t t = 0; t < threads; ++t) {
+        workers[t].join();
+        if (distinct) {
+            distinct->merge(thread_distinct[t]);
+        }
+        if (quantiles) {
+            quantiles->merge(thread_quantiles[t]);
+        }
+        delete thread_distinct[t];
+        delete thread_quantiles[t];
+    }
+    delete[] workers;
+    delete[] thread_quantiles;
+    delete[] thread_distinct;
+}
+
+
+/**
+ * Writes to std out a value found by a quantile sketch the way a value of its column is.
+ * @param value the value.
+ * @param t the type of the column.
+ */
+inline void print_quantile(double value, Types t) {
+    if (t == Types::FLOAT) {
+        std::cout << value << "\n";
+    } else {
+        std::cout << (long long) value << "\n";
+    }
+}
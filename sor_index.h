@@ -0,0 +1,494 @@
+//lang::Cpp
+
+
+/**
+ * SorIndex: Persistent, append-aware index of a .sor file
+ *
+ * Author: cao.yuan1@husky.neu.edu & zhan.d@husky.neu.edu
+ */
+
+
+#pragma once
+
+
+#include <cstdio>
+#include <cstring>
+
+
+#include <sys/stat.h>
+
+
+#include "object.h"
+#include "field_array.h"
+#include "helper.h"
+#include "types.h"
+#include "types_array.h"
+
+
+// identifies an index file and the version of its layout
+const char SOR_INDEX_MAGIC[8] = {'S', 'O', 'R', 'I', 'D', 'X', '0', '4'};
+
+// the number of bytes at the start and at the end of the indexed lines used to detect
+// a rewritten file
+const size_t SOR_INDEX_PREFIX = 4096;
+
+
+/**
+ * SorIndex: represents how far a .sor file has been indexed, together with its schema
+ * and the columnar representation and row table of every complete line indexed so far.
+ * The index is meant for files that only grow by appending lines: once saved and reloaded,
+ * only the lines appended after indexed_end_ are parsed. A file that was replaced or
+ * rewritten, as told by its inode, by being modified without growing, or by the bytes at
+ * both ends of the indexed lines, is indexed again from scratch.
+ *
+ * The index file only holds a header, the fields of each column, the rows and the rejected
+ * rows are each kept in a segment file next to it, named after the index file, the
+ * generation of the index and the segment. Saving appends the newly indexed lines to the
+ * segments and rewrites the header, which tells how many entries of each segment are
+ * valid, so that a reader of the previous header never sees the appended entries. Segments
+ * are only rewritten, under a new generation, when the file is indexed from scratch.
+ * Loading only reads the header, the segments are then read on demand by read().
+ *
+ * INVARIANT: the columnar, the rows and the rejected rows cover the same lines, which are
+ * all the complete lines that come before indexed_end_. A segment not read yet only holds
+ * the lines indexed since the index was loaded.
+ */
+class SorIndex : public Object {
+
+public:
+    size_t indexed_end_; // the byte just past the last indexed line
+    size_t prefix_hash_; // the hash of the first bytes of the indexed file
+    size_t suffix_hash_; // the hash of the last bytes of the indexed lines
+    size_t file_ino_; // the inode of the indexed file
+    size_t file_mtime_; // when the indexed file was last modified, when it was last indexed
+    size_t file_size_; // the size of the indexed file, when it was last indexed
+    size_t schema_rows_; // the number of lines the schema was inferred from
+    size_t num_rows_; // the number of valid rows indexed
+    size_t num_rejected_; // the number of rejected rows indexed
+    size_t generation_; // the generation the segment files are saved under
+    size_t saved_generation_; // the generation of the segment files on disk, 0 if none
+    size_t saved_width_; // the number of columns of the segment files on disk
+    size_t saved_rows_; // the number of valid rows in the segment files on disk
+    size_t saved_rejected_; // the number of rejected rows in the segment files on disk
+    TypesArray* schema_; // the schema (owned)
+    FieldArray** columnar_; // the columnar representation of the valid rows (owned)
+    FieldArray* rejected_; // the starting and ending bytes of the rejected rows (owned)
+    FieldArray* rows_; // the starting and ending bytes of the valid rows (owned)
+    bool* read_; // for each segment, whether its saved entries were read (owned)
+
+    /**
+     * Default constructor, creates an index of nothing.
+     */
+    SorIndex() : Object() {
+        this->indexed_end_ = 0;
+        this->prefix_hash_ = 0;
+        this->suffix_hash_ = 0;
+        this->file_ino_ = 0;
+        this->file_mtime_ = 0;
+        this->file_size_ = 0;
+        this->schema_rows_ = 0;
+        this->num_rows_ = 0;
+        this->num_rejected_ = 0;
+        this->generation_ = 0;
+        this->saved_generation_ = 0;
+        this->saved_width_ = 0;
+        this->saved_rows_ = 0;
+        this->saved_rejected_ = 0;
+        this->schema_ = nullptr;
+        this->columnar_ = nullptr;
+        this->rejected_ = nullptr;
+        this->rows_ = nullptr;
+        this->read_ = nullptr;
+    }
+
+    /**
+     * Default destructor.
+     */
+    virtual ~SorIndex() {
+        this->clear();
+    }
+
+    /**
+     * Empties this index so that it indexes nothing.
+     */
+    virtual void clear() {
+        if (this->columnar_) {
+            delete_columnar(this->columnar_, this->schema_->len());
+        }
+        delete this->schema_;
+        delete this->rejected_;
+        delete this->rows_;
+        delete[] this->read_;
+        this->indexed_end_ = 0;
+        this->prefix_hash_ = 0;
+        this->suffix_hash_ = 0;
+        this->file_ino_ = 0;
+        this->file_mtime_ = 0;
+        this->file_size_ = 0;
+        this->schema_rows_ = 0;
+        this->num_rows_ = 0;
+        this->num_rejected_ = 0;
+        this->generation_ = 0;
+        this->saved_generation_ = 0;
+        this->saved_width_ = 0;
+        this->saved_rows_ = 0;
+        this->saved_rejected_ = 0;
+        this->schema_ = nullptr;
+        this->columnar_ = nullptr;
+        this->rejected_ = nullptr;
+        this->rows_ = nullptr;
+        this->read_ = nullptr;
+    }
+
+    /**
+     * Replaces the content of this index by the header stored in the given index file.
+     * The segments are left to read(). A damaged header, or segment files too short for
+     * it, leaves this index empty so that it is built again.
+     * @param path the index file.
+     * @return whether the index file existed, was read entirely and is consistent.
+     */
+    virtual bool load(const char* path) {
+        this->clear();
+        FILE* in = fopen(path, "rb");
+        if (!in) {
+            return false;
+        }
+        char magic[sizeof(SOR_INDEX_MAGIC)];
+        bool ok = fread(magic, sizeof(magic), 1, in) == 1
+                  && memcmp(magic, SOR_INDEX_MAGIC, sizeof(magic)) == 0
+                  && fread(&this->indexed_end_, sizeof(size_t), 1, in) == 1
+                  && fread(&this->prefix_hash_, sizeof(size_t), 1, in) == 1
+                  && fread(&this->suffix_hash_, sizeof(size_t), 1, in) == 1
+                  && fread(&this->file_ino_, sizeof(size_t), 1, in) == 1
+                  && fread(&this->file_mtime_, sizeof(size_t), 1, in) == 1
+                  && fread(&this->file_size_, sizeof(size_t), 1, in) == 1
+                  && fread(&this->schema_rows_, sizeof(size_t), 1, in) == 1
+                  && fread(&this->generation_, sizeof(size_t), 1, in) == 1
+                  && fread(&this->num_rows_, sizeof(size_t), 1, in) == 1
+                  && fread(&this->num_rejected_, sizeof(size_t), 1, in) == 1
+                  && this->indexed_end_ <= this->file_size_ && this->generation_ > 0
+                  && this->num_rows_ + this->num_rejected_ <= this->indexed_end_;
+        if (ok) {
+            this->schema_ = new TypesArray();
+            ok = this->schema_->read(in);
+        }
+        fclose(in);
+        if (ok) {
+            size_t width = this->schema_->len();
+            this->saved_generation_ = this->generation_;
+            this->saved_width_ = width;
+            this->saved_rows_ = this->num_rows_;
+            this->saved_rejected_ = this->num_rejected_;
+            this->columnar_ = make_columnar(nullptr, 0, 0, this->schema_);
+            this->rejected_ = new FieldArray();
+            this->rows_ = new FieldArray();
+            this->read_ = new bool[width + 2]();
+            // a cut segment would be read as fewer entries than the header claims
+            for (size_t s = 0; s < width + 2 && ok; ++s) {
+                char* segment = segment_path_(path, this->generation_, s);
+                struct stat st;
+                ok = stat(segment, &st) == 0
+                     && (size_t) st.st_size >= this->saved_count_(s) * 2 * sizeof(int);
+                delete[] segment;
+            }
+        }
+        if (!ok) {
+            this->clear();
+        }
+        return ok;
+    }
+
+    /**
+     * Reads the saved entries of the given segments, so that they cover every indexed line.
+     * A damaged segment makes the whole file be indexed again, since the saved entries of
+     * the other segments can no longer be trusted either.
+     *
+     * @param path the index file.
+     * @param file the file we are working on, as given to update().
+     * @param needed tells for each column whether to read it, null for all of them.
+     * @param with_rows whether to read the rows.
+     * @param with_rejected whether to read the rejected rows.
+     * @return false if a segment could not be read and the file was indexed again, so that
+     *         the index needs to be saved again, true otherwise.
+     */
+    virtual bool read(const char* path, char* file, bool* needed, bool with_rows,
+                      bool with_rejected) {
+        size_t width = this->schema_->len();
+        bool ok = true;
+        for (size_t s = 0; s < width + 2 && ok; ++s) {
+            bool wanted = s < width ? !needed || needed[s] : s == width ? with_rows : with_rejected;
+            if (wanted && !this->read_[s]) {
+                ok = this->read_segment_(path, s);
+            }
+        }
+        if (!ok) {
+            this->rebuild_(file, this->indexed_end_);
+        }
+        return ok;
+    }
+
+    /**
+     * Writes this index to the given index file and its segment files. The entries indexed
+     * since the index was loaded are appended to the segments, then the header is written
+     * to a temporary file that replaces the index file, so a concurrent load never reads a
+     * partly written index. The segments of an older generation are then removed.
+     * @param path the index file.
+     * @return whether the index was written entirely.
+     */
+    virtual bool save(const char* path) {
+        assert(this->schema_);
+        size_t width = this->schema_->len();
+        bool ok = true;
+        for (size_t s = 0; s < width + 2 && ok; ++s) {
+            size_t saved = this->saved_count_(s);
+            char* segment = segment_path_(path, this->generation_, s);
+            FILE* out = fopen(segment, saved > 0 ? "r+b" : "wb");
+            delete[] segment;
+            // a segment not read yet starts with the first entry not saved
+            ok = out && fseek(out, saved * 2 * sizeof(int), SEEK_SET) == 0
+                 && (*this->slot_(s))->write(out, this->read_[s] ? saved : 0);
+            ok = out && fclose(out) == 0 && ok;
+        }
+        char* tmp = temp_path(path);
+        FILE* out = ok ? fopen(tmp, "wb") : nullptr;
+        ok = out
+             && fwrite(SOR_INDEX_MAGIC, sizeof(SOR_INDEX_MAGIC), 1, out) == 1
+             && fwrite(&this->indexed_end_, sizeof(size_t), 1, out) == 1
+             && fwrite(&this->prefix_hash_, sizeof(size_t), 1, out) == 1
+             && fwrite(&this->suffix_hash_, sizeof(size_t), 1, out) == 1
+             && fwrite(&this->file_ino_, sizeof(size_t), 1, out) == 1
+             && fwrite(&this->file_mtime_, sizeof(size_t), 1, out) == 1
+             && fwrite(&this->file_size_, sizeof(size_t), 1, out) == 1
+             && fwrite(&this->schema_rows_, sizeof(size_t), 1, out) == 1
+             && fwrite(&this->generation_, sizeof(size_t), 1, out) == 1
+             && fwrite(&this->num_rows_, sizeof(size_t), 1, out) == 1
+             && fwrite(&this->num_rejected_, sizeof(size_t), 1, out) == 1
+             && this->schema_->write(out);
+        ok = out && fclose(out) == 0 && ok;
+        ok = out && replace_file(tmp, path, ok);
+        delete[] tmp;
+        if (ok && this->saved_generation_ != 0 && this->saved_generation_ != this->generation_) {
+            for (size_t s = 0; s < this->saved_width_ + 2; ++s) {
+                char* segment = segment_path_(path, this->saved_generation_, s);
+                remove(segment);
+                delete[] segment;
+            }
+            this->saved_generation_ = this->generation_;
+            this->saved_width_ = width;
+        }
+        return ok;
+    }
+
+    /**
+     * Brings this index up to date with the given file. If the index was built from an
+     * earlier version of the same file, only the appended lines are parsed. Otherwise the
+     * whole file is indexed again.
+     *
+     * NOTE: a last line that is not terminated by '\n' may still be being written,
+     *       so it is never indexed.
+     *
+     * @param file the file we are working on.
+     * @param file_size the size of the file.
+     * @param file_ino the inode of the file.
+     * @param file_mtime when the file was last modified.
+     * @return whether the indexed lines or the schema changed, so that the index needs
+     *         to be saved again.
+     */
+    virtual bool update(char* file, size_t file_size, size_t file_ino, size_t file_mtime) {
+        if (this->schema_ && this->file_ino_ == file_ino && this->file_mtime_ == file_mtime
+            && this->file_size_ == file_size) {
+            // the file was not touched since it was indexed
+            return false;
+        }
+        // a file that was modified without growing was not appended to
+        bool same_file = this->schema_ && this->file_ino_ == file_ino
+                         && file_size > this->file_size_
+                         && this->prefix_hash_ == hash_prefix_(file, this->indexed_end_)
+                         && this->suffix_hash_ == hash_suffix_(file, this->indexed_end_);
+        this->file_ino_ = file_ino;
+        this->file_mtime_ = file_mtime;
+        this->file_size_ = file_size;
+        size_t complete_end = file_size;
+        while (complete_end > 0 && file[complete_end - 1] != '\n') {
+            --complete_end;
+        }
+        if (!same_file) {
+            this->rebuild_(file, complete_end);
+            return true;
+        }
+        bool changed = complete_end != this->indexed_end_;
+        // the schema is only inferred from the first lines, so it can only change while
+        // the file is shorter than that
+        if (this->schema_rows_ < SCHEMA_ROWS) {
+            size_t rows;
+            TypesArray* schema = parse_schema(file, complete_end, &rows);
+            bool same_schema = schema->len() == this->schema_->len();
+            for (size_t i = 0; i < schema->len() && same_schema; ++i) {
+                same_schema = schema->get(i) == this->schema_->get(i);
+            }
+            delete schema;
+            if (!same_schema) {
+                // the indexed lines are fewer than SCHEMA_ROWS, so indexing the file again
+                // costs about as much as parsing the appended lines
+                this->rebuild_(file, complete_end);
+                return true;
+            }
+            changed = changed || rows != this->schema_rows_;
+            this->schema_rows_ = rows;
+        }
+        size_t rejected = this->rejected_->len();
+        this->num_rows_ += append_columnar(file, this->indexed_end_, complete_end, this->schema_,
+                                           this->columnar_, this->rejected_, this->rows_);
+        this->num_rejected_ += this->rejected_->len() - rejected;
+        this->indexed_end_ = complete_end;
+        this->prefix_hash_ = hash_prefix_(file, this->indexed_end_);
+        this->suffix_hash_ = hash_suffix_(file, this->indexed_end_);
+        return changed;
+    }
+
+    /**
+     * Returns the field array holding the entries of a segment.
+     * @param s the segment, the columns come first, then the rows and the rejected rows.
+     * @return where the field array of the segment is kept.
+     */
+    virtual FieldArray** slot_(size_t s) {
+        size_t width = this->schema_->len();
+        if (s < width) {
+            return &this->columnar_[s];
+        }
+        return s == width ? &this->rows_ : &this->rejected_;
+    }
+
+    /**
+     * Returns the number of entries of a segment in the segment files on disk.
+     * @param s the segment.
+     * @return the number of entries.
+     */
+    virtual size_t saved_count_(size_t s) {
+        return s == this->schema_->len() + 1 ? this->saved_rejected_ : this->saved_rows_;
+    }
+
+    /**
+     * Reads the saved entries of a segment in front of those indexed since it was loaded.
+     * @param path the index file.
+     * @param s the segment.
+     * @return whether the segment file was read entirely and its entries lie within the
+     *         indexed lines.
+     */
+    virtual bool read_segment_(const char* path, size_t s) {
+        FieldArray** slot = this->slot_(s);
+        FieldArray* fields = new FieldArray();
+        fields->set_type((*slot)->type_);
+        char* segment = segment_path_(path, this->saved_generation_, s);
+        FILE* in = fopen(segment, "rb");
+        delete[] segment;
+        bool ok = in && fields->read(in, this->saved_count_(s))
+                  && within_(fields, this->indexed_end_);
+        if (in) {
+            fclose(in);
+        }
+        if (!ok) {
+            delete fields;
+            return false;
+        }
+        FieldArray* appended = *slot;
+        fields->reserve(fields->len() + appended->len());
+        for (size_t i = 0; i < appended->len(); ++i) {
+            fields->pushBack(appended->get_start(i), appended->get_end(i));
+        }
+        delete appended;
+        *slot = fields;
+        this->read_[s] = true;
+        return true;
+    }
+
+    /**
+     * Returns the path of a segment file of an index file.
+     * @param path the index file.
+     * @param generation the generation of the segment.
+     * @param s the segment.
+     * @return the path of the segment file (owned by the caller).
+     */
+    static char* segment_path_(const char* path, size_t generation, size_t s) {
+        size_t len = strlen(path) + 48;
+        char* segment = new char[len];
+        snprintf(segment, len, "%s.%zu.%zu", path, generation, s);
+        return segment;
+    }
+
+    /**
+     * Determines whether the fields of a field array lie within the given number of bytes.
+     * @param fields the field array.
+     * @param end the byte the fields must end before.
+     * @return whether every field starts no later than it ends, and ends before end.
+     */
+    static bool within_(FieldArray* fields, size_t end) {
+        for (size_t i = 0; i < fields->len(); ++i) {
+            if (fields->get_start(i) < 0 || fields->get_start(i) > fields->get_end(i)
+                || (size_t) fields->get_end(i) >= end) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    /**
+     * Hashes the bytes at the start of a file that an index built up to the given byte covers.
+     * @param file the file we are working on.
+     * @param indexed_end the byte just past the last indexed line.
+     * @return the hash of the prefix.
+     */
+    static size_t hash_prefix_(char* file, size_t indexed_end) {
+        return hash_bytes(file, indexed_end < SOR_INDEX_PREFIX ? indexed_end : SOR_INDEX_PREFIX);
+    }
+
+    /**
+     * Hashes the last bytes of the lines an index built up to the given byte covers.
+     * @param file the file we are working on.
+     * @param indexed_end the byte just past the last indexed line.
+     * @return the hash of the suffix.
+     */
+    static size_t hash_suffix_(char* file, size_t indexed_end) {
+        size_t len = indexed_end < SOR_INDEX_PREFIX ? indexed_end : SOR_INDEX_PREFIX;
+        return hash_bytes(&file[indexed_end - len], len);
+    }
+
+    /**
+     * Discards this index and indexes the given file from scratch, under a new generation
+     * so that the segments on disk are left alone until the index is saved.
+     * @param file the file we are working on.
+     * @param complete_end the byte just past the last complete line of the file.
+     */
+    virtual void rebuild_(char* file, size_t complete_end) {
+        // the file indexed and the segments on disk stay the same
+        size_t file_ino = this->file_ino_;
+        size_t file_mtime = this->file_mtime_;
+        size_t file_size = this->file_size_;
+        size_t saved_generation = this->saved_generation_;
+        size_t saved_width = this->saved_width_;
+        size_t generation = this->generation_ > saved_generation ? this->generation_
+                                                                 : saved_generation;
+        this->clear();
+        this->file_ino_ = file_ino;
+        this->file_mtime_ = file_mtime;
+        this->file_size_ = file_size;
+        this->saved_generation_ = saved_generation;
+        this->saved_width_ = saved_width;
+        this->generation_ = generation + 1;
+        this->schema_ = parse_schema(file, complete_end, &this->schema_rows_);
+        this->rejected_ = new FieldArray();
+        this->rows_ = new FieldArray();
+        this->columnar_ = make_columnar(file, 0, complete_end, this->schema_, this->rejected_,
+                                        this->rows_);
+        this->num_rows_ = this->rows_->len();
+        this->num_rejected_ = this->rejected_->len();
+        // every segment is in memory and none of it is saved under the new generation
+        this->read_ = new bool[this->schema_->len() + 2];
+        for (size_t s = 0; s < this->schema_->len() + 2; ++s) {
+            this->read_[s] = true;
+        }
+        this->indexed_end_ = complete_end;
+        this->prefix_hash_ = hash_prefix_(file, this->indexed_end_);
+        this->suffix_hash_ = hash_suffix_(file, this->indexed_end_);
+    }
+};
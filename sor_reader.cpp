@@ -0,0 +1,207 @@
+//lang::Cpp
+
+
+/**
+ * SorReader: Library interface to read .sor files from C++ code
+ *
+ * Author: cao.yuan1@husky.neu.edu & zhan.d@husky.neu.edu
+ */
+
+
+#include <cassert>
+#include <cstdint>
+
+
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+
+#include "helper.h"
+#include "sor_reader.h"
+
+
+ColumnBatch::ColumnBatch(char* file, TypesArray* schema, bool* projection) : Object() {
+    this->file_ = file;
+    this->schema_ = schema;
+    this->columns_ = make_columnar(file, 0, 0, schema, nullptr, nullptr, projection);
+    this->rows_ = new FieldArray();
+    this->first_row_ = 0;
+}
+
+ColumnBatch::~ColumnBatch() {
+    delete_columnar(this->columns_, this->schema_->len());
+    delete this->rows_;
+}
+
+size_t ColumnBatch::len() {
+    return this->rows_->len();
+}
+
+size_t ColumnBatch::width() {
+    return this->schema_->len();
+}
+
+bool ColumnBatch::has_column(size_t col) {
+    return col < this->schema_->len() && this->columns_[col];
+}
+
+FieldView ColumnBatch::get_row(size_t row) {
+    assert(row < this->len());
+    FieldView view;
+    view.bytes = &this->file_[this->rows_->get_start(row)];
+    view.len = this->rows_->get_end(row) - this->rows_->get_start(row);
+    return view;
+}
+
+Types ColumnBatch::type(size_t col) {
+    return this->schema_->get(col);
+}
+
+bool ColumnBatch::is_missing(size_t col, size_t row) {
+    assert(row < this->len() && this->has_column(col));
+    size_t value_start;
+    size_t value_end;
+    return !field_value(this->file_, this->columns_[col]->get_start(row),
+                        this->columns_[col]->get_end(row), this->type(col),
+                        &value_start, &value_end);
+}
+
+bool ColumnBatch::get_bool(size_t col, size_t row) {
+    return this->get_int(col, row) != 0;
+}
+
+long long ColumnBatch::get_int(size_t col, size_t row) {
+    assert(this->type(col) <= Types::INT);
+    FieldView view = this->get_string(col, row);
+    return view.len == 0 ? 0 : strtoll(view.bytes, nullptr, 10);
+}
+
+long double ColumnBatch::get_float(size_t col, size_t row) {
+    assert(this->type(col) <= Types::FLOAT);
+    FieldView view = this->get_string(col, row);
+    return view.len == 0 ? 0 : strtold(view.bytes, nullptr);
+}
+
+FieldView ColumnBatch::get_string(size_t col, size_t row) {
+    assert(row < this->len() && this->has_column(col));
+    FieldView view = {nullptr, 0};
+    size_t value_start;
+    size_t value_end;
+    if (field_value(this->file_, this->columns_[col]->get_start(row),
+                    this->columns_[col]->get_end(row), this->type(col),
+                    &value_start, &value_end)) {
+        view.bytes = &this->file_[value_start];
+        view.len = value_end + 1 - value_start;
+    }
+    return view;
+}
+
+void ColumnBatch::clear() {
+    for (size_t i = 0; i < this->schema_->len(); ++i) {
+        if (this->columns_[i]) {
+            this->columns_[i]->clear();
+        }
+    }
+    this->rows_->clear();
+}
+
+
+SorReader::SorReader() : Object() {
+    this->fd_ = -1;
+    this->file_ = nullptr;
+    this->file_size_ = 0;
+    this->map_size_ = 0;
+    this->schema_ = nullptr;
+    this->cursor_ = 0;
+    this->end_ = 0;
+    this->next_row_ = 0;
+    this->batch_ = nullptr;
+    this->projection_ = nullptr;
+}
+
+SorReader::~SorReader() {
+    this->close();
+}
+
+bool SorReader::open(const char* path) {
+    this->close();
+    int fd = ::open(path, O_RDONLY);
+    if (fd == -1) {
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        ::close(fd);
+        return false;
+    }
+    // map one more page than needed so the file is followed by '\0'
+    size_t pg_size = getpagesize();
+    this->file_size_ = st.st_size;
+    this->map_size_ = (this->file_size_ / pg_size + 1) * pg_size;
+    void* file = mmap(nullptr, this->map_size_, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (file == MAP_FAILED) {
+        ::close(fd);
+        return false;
+    }
+    this->fd_ = fd;
+    this->file_ = (char*) file;
+    this->schema_ = parse_schema(this->file_, this->file_size_);
+    this->batch_ = new ColumnBatch(this->file_, this->schema_, nullptr);
+    this->set_range(0, SIZE_MAX);
+    return true;
+}
+
+void SorReader::close() {
+    if (this->fd_ == -1) {
+        return;
+    }
+    delete this->batch_;
+    delete[] this->projection_;
+    delete this->schema_;
+    munmap(this->file_, this->map_size_);
+    ::close(this->fd_);
+    this->fd_ = -1;
+    this->file_ = nullptr;
+    this->file_size_ = 0;
+    this->map_size_ = 0;
+    this->schema_ = nullptr;
+    this->batch_ = nullptr;
+    this->projection_ = nullptr;
+}
+
+TypesArray* SorReader::schema() {
+    return this->schema_;
+}
+
+void SorReader::set_projection(size_t* cols, size_t num_cols) {
+    assert(this->fd_ != -1);
+    size_t width = this->schema_->len();
+    delete[] this->projection_;
+    this->projection_ = new bool[width]();
+    for (size_t i = 0; i < num_cols; ++i) {
+        assert(cols[i] < width);
+        this->projection_[cols[i]] = true;
+    }
+    delete this->batch_;
+    this->batch_ = new ColumnBatch(this->file_, this->schema_, this->projection_);
+}
+
+void SorReader::set_range(size_t from, size_t len) {
+    assert(this->fd_ != -1);
+    trim_range(this->file_, this->file_size_, from, len, &this->cursor_, &this->end_);
+    this->next_row_ = 0;
+}
+
+ColumnBatch* SorReader::next_batch(size_t n) {
+    assert(this->fd_ != -1);
+    this->batch_->clear();
+    this->batch_->first_row_ = this->next_row_;
+    if (this->cursor_ < this->end_) {
+        this->cursor_ = append_columnar(this->file_, this->cursor_, this->end_, this->schema_,
+                                        this->batch_->columns_, nullptr, this->batch_->rows_, n);
+    }
+    this->next_row_ += this->batch_->len();
+    return this->batch_;
+}
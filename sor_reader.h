@@ -0,0 +1,214 @@
+//lang::Cpp
+
+
+/**
+ * SorReader: Library interface to read .sor files from C++ code
+ *
+ * Author: cao.yuan1@husky.neu.edu & zhan.d@husky.neu.edu
+ */
+
+
+#pragma once
+
+
+#include <cstdlib>
+
+
+#include "object.h"
+#include "field_array.h"
+#include "types.h"
+#include "types_array.h"
+
+
+/**
+ * FieldView: the bytes of the value of a field, read in place from the file.
+ * The bytes are not terminated by '\0' and are valid as long as the reader is open.
+ */
+struct FieldView {
+    const char* bytes; // the first byte of the value
+    size_t len; // the number of bytes of the value
+};
+
+
+/**
+ * ColumnBatch: represents a batch of consecutive valid rows of a .sor file in columnar form.
+ * The fields are not copied, getters read them from the file of the reader that made the batch.
+ * A row of a batch is its index in the batch, row 0 being row first_row_ of the file.
+ * Only the columns of the projection of the reader are built, the getters must not be
+ * asked for the others.
+ */
+class ColumnBatch : public Object {
+
+public:
+    char* file_; // the file the fields are in (external)
+    TypesArray* schema_; // the schema of the file (external)
+    FieldArray** columns_; // the starting and ending bytes of the fields of each column,
+                           // null for the columns not built (owned)
+    FieldArray* rows_; // the starting and ending bytes of each row (owned)
+    size_t first_row_; // the index among the valid rows of the file of the first row
+
+    /**
+     * Constructs an empty batch of a file with the given schema.
+     * @param file the file the fields are in.
+     * @param schema the schema of the file.
+     * @param projection tells for each column whether to build it, null for all of them.
+     */
+    ColumnBatch(char* file, TypesArray* schema, bool* projection);
+
+    /**
+     * Default destructor.
+     */
+    virtual ~ColumnBatch();
+
+    /**
+     * Returns the number of rows in this batch.
+     * @return the number of rows.
+     */
+    virtual size_t len();
+
+    /**
+     * Returns the number of columns of this batch.
+     * @return the number of columns.
+     */
+    virtual size_t width();
+
+    /**
+     * Determines whether a column is built.
+     * @param col the column.
+     * @return whether it is in the projection.
+     */
+    virtual bool has_column(size_t col);
+
+    /**
+     * Returns the bytes of a row as they are in the file, without its '\n'.
+     * @param row the row.
+     * @return the view of the row.
+     */
+    virtual FieldView get_row(size_t row);
+
+    /**
+     * Returns the type of a column.
+     * @param col the column.
+     * @return its type.
+     */
+    virtual Types type(size_t col);
+
+    /**
+     * Determines whether a field is missing.
+     * @param col the column of the field.
+     * @param row the row of the field.
+     * @return whether it is missing.
+     */
+    virtual bool is_missing(size_t col, size_t row);
+
+    /**
+     * Returns the value of a field of a BOOL column.
+     * @param col the column of the field.
+     * @param row the row of the field.
+     * @return the value, false if missing.
+     */
+    virtual bool get_bool(size_t col, size_t row);
+
+    /**
+     * Returns the value of a field of a BOOL or INT column.
+     * @param col the column of the field.
+     * @param row the row of the field.
+     * @return the value, 0 if missing.
+     */
+    virtual long long get_int(size_t col, size_t row);
+
+    /**
+     * Returns the value of a field of a BOOL, INT or FLOAT column.
+     * @param col the column of the field.
+     * @param row the row of the field.
+     * @return the value, 0 if missing.
+     */
+    virtual long double get_float(size_t col, size_t row);
+
+    /**
+     * Returns the bytes of the value of a field, without the spaces around it and,
+     * in a STRING column, without the quotes around it.
+     * @param col the column of the field.
+     * @param row the row of the field.
+     * @return the view of the value, of length 0 if missing.
+     */
+    virtual FieldView get_string(size_t col, size_t row);
+
+    /**
+     * Empties this batch.
+     */
+    virtual void clear();
+};
+
+
+/**
+ * SorReader: represents an open .sor file, mapped in memory, that is read batch by batch.
+ * The schema is inferred when the file is opened, the same way the sorer program does.
+ */
+class SorReader : public Object {
+
+public:
+    int fd_; // the file descriptor of the file, -1 if not open
+    char* file_; // the mapped file
+    size_t file_size_; // the size of the file
+    size_t map_size_; // the number of bytes mapped
+    TypesArray* schema_; // the schema of the file (owned)
+    size_t cursor_; // the byte the next batch starts at
+    size_t end_; // the byte to stop reading at
+    size_t next_row_; // the index among the valid rows of the first row of the next batch
+    ColumnBatch* batch_; // the batch reused by next_batch (owned)
+    bool* projection_; // the columns to build, null for all of them (owned)
+
+    /**
+     * Default constructor, the reader is not open.
+     */
+    SorReader();
+
+    /**
+     * Default destructor, closes the reader.
+     */
+    virtual ~SorReader();
+
+    /**
+     * Opens a file and infers its schema. Reading starts at the beginning of the file.
+     * @param path the path of the file.
+     * @return whether the file could be opened and mapped.
+     */
+    virtual bool open(const char* path);
+
+    /**
+     * Closes the file. Batches and views obtained from it are no longer valid.
+     */
+    virtual void close();
+
+    /**
+     * Returns the schema of the open file.
+     * @return the schema, owned by the reader.
+     */
+    virtual TypesArray* schema();
+
+    /**
+     * Restricts the columns built in the batches to the given ones. Rows are still
+     * validated against the whole schema.
+     * @param cols the columns to build.
+     * @param num_cols the number of columns to build.
+     */
+    virtual void set_projection(size_t* cols, size_t num_cols);
+
+    /**
+     * Restricts reading to the given bytes of the file, the same way -from and -len do:
+     * the line the first byte falls in is discarded unless it is 0, and so is a last line
+     * cut by the end. Reading starts again from the first line left.
+     * @param from the byte to start reading from.
+     * @param len the number of bytes to read.
+     */
+    virtual void set_range(size_t from, size_t len);
+
+    /**
+     * Reads the next valid rows of the file.
+     * @param n the maximum number of rows to read.
+     * @return the batch of rows read, owned by the reader and reused by the next call,
+     *         empty once every row was read.
+     */
+    virtual ColumnBatch* next_batch(size_t n);
+};
@@ -0,0 +1,277 @@
+//lang::Cpp
+
+
+/**
+ * Sorting the rows of a .sor file by a column
+ *
+ * Author: cao.yuan1@husky.neu.edu & zhan.d@husky.neu.edu
+ */
+
+
+#pragma once
+
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <thread>
+
+
+#include "field_array.h"
+#include "helper.h"
+#include "types.h"
+
+
+// the number of rows each sorting thread is given at least
+const size_t SORT_ROWS_PER_THREAD = 1 << 16;
+
+// the maximum number of sorting threads
+const size_t SORT_MAX_THREADS = 16;
+
+
+/**
+ * Returns the number of threads to use to sort the given number of rows.
+ * @param n the number of rows.
+ * @return the number of threads, at least 1.
+ */
+inline size_t sort_threads(size_t n) {
+    size_t threads = std::thread::hardware_concurrency();
+    if (threads > SORT_MAX_THREADS) {
+        threads = SORT_MAX_THREADS;
+    }
+    if (threads > n / SORT_ROWS_PER_THREAD) {
+        threads = n / SORT_ROWS_PER_THREAD;
+    }
+    return threads == 0 ? 1 : threads;
+}
+
+
+/**
+ * Returns a key of the value of a non missing BOOL, INT or FLOAT field such that
+ * comparing the keys as unsigned integers orders the values.
+ *
+ * @param file the file we are working on.
+ * @param start the first byte of the value.
+ * @param t the type of the field.
+ * @return the key.
+ */
+inline uint64_t sort_key(char* file, size_t start, Types t) {
+    if (t == Types::FLOAT) {
+        double val = (double) strtold(&file[start], nullptr) + 0.0;
+        uint64_t bits;
+        memcpy(&bits, &val, sizeof(bits));
+        // negative values are ordered backwards, positive ones after them
+        return (bits >> 63) ? ~bits : bits | ((uint64_t) 1 << 63);
+    }
+    long long val = strtoll(&file[start], nullptr, 10);
+    return (uint64_t) val ^ ((uint64_t) 1 << 63);
+}
+
+
+/**
+ * Sorts rows by their key with a stable LSD radix sort, one byte at a time, where each
+ * thread counts and then places the keys of its own slice of the rows.
+ *
+ * @param keys the keys of the rows.
+ * @param rows the rows.
+ * @param n the number of rows.
+ * MUTATION: keys and rows are sorted by key.
+ */
+inline void radix_sort(uint64_t* keys, size_t* rows, size_t n) {
+    size_t threads = sort_threads(n);
+    uint64_t* tmp_keys = new uint64_t[n];
+    size_t* tmp_rows = new size_t[n];
+    // counts[t * 256 + d] the number of keys of thread t with digit d, then where they go
+    size_t* counts = new size_t[threads * 256];
+    std::thread* workers = new std::thread[threads];
+    size_t slice = (n + threads - 1) / threads;
+    for (size_t shift = 0; shift < 64; shift += 8) {
+        memset(counts, 0, threads * 256 * sizeof(size_t));
+        for (size_t t = 0; t < threads; ++t) {
+            workers[t] = std::thread([=]() {
+                size_t end = std::min(n, (t + 1) * slice);
+                for (size_t i = t * slice; i < end; ++i) {
+                    counts[t * 256 + ((keys[i] >> shift) & 0xFF)] += 1;
+                }
+            });
+        }
+        for (size_t t = 0; t < threads; ++t) {
+            workers[t].join();
+        }
+        // skip the byte if every key has the same one
+        bool same = false;
+        for (size_t d = 0; d < 256 && !same; ++d) {
+            size_t total = 0;
+            for (size_t t = 0; t < threads; ++t) {
+                total += counts[t * 256 + d];
+            }
+            same = total == n;
+        }
+        if (same) {
+            continue;
+        }
+        size_t pos = 0;
+        for (size_t d = 0; d < 256; ++d) {
+            for (size_t t = 0; t < threads; ++t) {
+                size_t count = counts[t * 256 + d];
+                counts[t * 256 + d] = pos;
+                pos += count;
+            }
+        }
+        for (size_t t = 0; t < threads; ++t) {
+            workers[t] = std::thread([=]() {
+                size_t end = std::min(n, (t + 1) * slice);
+                for (size_t i = t * slice; i < end; ++i) {
+                    size_t dest = counts[t * 256 + ((keys[i] >> shift) & 0xFF)]++;
+                    tmp_keys[dest] = keys[i];
+                    tmp_rows[dest] = rows[i];
+                }
+            });
+        }
+        for (size_t t = 0; t < threads; ++t) {
+            workers[t].join();
+        }
+        memcpy(keys, tmp_keys, n * sizeof(uint64_t));
+        memcpy(rows, tmp_rows, n * sizeof(size_t));
+    }
+    delete[] workers;
+    delete[] counts;
+    delete[] tmp_rows;
+    delete[] tmp_keys;
+}
+
+
+/**
+ * StringKey: the row of a non missing STRING field and the bytes of its value,
+ * which are read from the file without copying them.
+ */
+struct StringKey {
+    size_t row; // the row
+    const char* bytes; // the first byte of the value in the file
+    size_t len; // the number of bytes of the value
+};
+
+
+/**
+ * Orders two string keys by the bytes of their values.
+ * @param a the first key.
+ * @param b the second key.
+ * @return whether the value of a comes before the one of b.
+ */
+inline bool string_key_less(const StringKey& a, const StringKey& b) {
+    int cmp = memcmp(a.bytes, b.bytes, std::min(a.len, b.len));
+    return cmp < 0 || (cmp == 0 && a.len < b.len);
+}
+
+
+/**
+ * Sorts string keys with a stable merge sort: each thread sorts its own slice, then
+ * neighbouring slices are merged in parallel until a single one is left.
+ *
+ * @param keys the keys to sort.
+ * @param n the number of keys.
+ * @param descending whether to sort in descending order.
+ * MUTATION: keys are sorted.
+ */
+inline void merge_sort(StringKey* keys, size_t n, bool descending) {
+    auto less = [descending](const StringKey& a, const StringKey& b) {
+        return descending ? string_key_less(b, a) : string_key_less(a, b);
+    };
+    size_t threads = sort_threads(n);
+    std::thread* workers = new std::thread[threads];
+    size_t slice = (n + threads - 1) / threads;
+    for (size_t t = 0; t < threads; ++t) {
+        workers[t] = std::thread([=]() {
+            std::stable_sort(keys + std::min(n, t * slice), keys + std::min(n, (t + 1) * slice),
+                             less);
+        });
+    }
+    for (size_t t = 0; t < threads; ++t) {
+        workers[t].join();
+    }
+    StringKey* tmp = new StringKey[n];
+    for (; slice < n; slice *= 2) {
+        size_t merges = (n + 2 * slice - 1) / (2 * slice);
+        for (size_t m = 0; m < merges; ++m) {
+            workers[m % threads] = std::thread([=]() {
+                size_t start = m * 2 * slice;
+                size_t mid = std::min(n, start + slice);
+                size_t end = std::min(n, start + 2 * slice);
+                std::merge(keys + start, keys + mid, keys + mid, keys + end, tmp + start, less);
+            });
+            if (m % threads == threads - 1 || m == merges - 1) {
+                for (size_t t = 0; t <= m % threads; ++t) {
+                    workers[t].join();
+                }
+            }
+        }
+        memcpy(keys, tmp, n * sizeof(StringKey));
+    }
+    delete[] tmp;
+    delete[] workers;
+}
+
+
+/**
+ * Orders the given rows of a column by their value. Rows with equal values keep their order.
+ *
+ * @param file the file we are working on.
+ * @param column the column to sort by.
+ * @param first the first row to sort.
+ * @param count the number of rows to sort.
+ * @param descending whether to sort in descending order.
+ * @param missing_first whether the rows with a missing value come before the others,
+ *                      instead of after them.
+ * @return the count rows, ordered.
+ */
+inline size_t* sort_column(char* file, FieldArray* column, size_t first, size_t count,
+                           bool descending, bool missing_first) {
+    Types t = column->type_;
+    size_t* sorted = new size_t[count];
+    size_t* missing = new size_t[count];
+    size_t num_missing = 0;
+    size_t num_present = 0;
+    uint64_t* keys = nullptr;
+    StringKey* string_keys = nullptr;
+    if (t == Types::STRING) {
+        string_keys = new StringKey[count];
+    } else {
+        keys = new uint64_t[count];
+    }
+    for (size_t row = first; row < first + count; ++row) {
+        size_t value_start;
+        size_t value_end;
+        if (!field_value(file, column->get_start(row), column->get_end(row), t,
+                         &value_start, &value_end)) {
+            missing[num_missing++] = row;
+        } else if (string_keys) {
+            string_keys[num_present].row = row;
+            string_keys[num_present].bytes = &file[value_start];
+            string_keys[num_present].len = value_end + 1 - value_start;
+            ++num_present;
+        } else {
+            uint64_t key = sort_key(file, value_start, t);
+            keys[num_present] = descending ? ~key : key;
+            sorted[num_present] = row;
+            ++num_present;
+        }
+    }
+    size_t* present = sorted;
+    if (missing_first) {
+        present = &sorted[num_missing];
+    }
+    if (string_keys) {
+        merge_sort(string_keys, num_present, descending);
+        for (size_t i = 0; i < num_present; ++i) {
+            present[i] = string_keys[i].row;
+        }
+    } else {
+        radix_sort(keys, sorted, num_present);
+        memmove(present, sorted, num_present * sizeof(size_t));
+    }
+    memcpy(missing_first ? sorted : &sorted[num_present], missing, num_missing * sizeof(size_t));
+    delete[] keys;
+    delete[] string_keys;
+    delete[] missing;
+    return sorted;
+}
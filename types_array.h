@@ -6,6 +6,7 @@
 
 #include <assert.h>
 #include <math.h>
+#include <stdio.h>
 
 
 #include "object.h"
@@ -107,4 +108,44 @@ public:
     virtual void clear() {
         this->size_ = 0;
     }
+
+    /**
+     * Writes the values of this array to a file.
+     * @param out the file to write to.
+     * @return whether all of it was written.
+     */
+    virtual bool write(FILE* out) {
+        if (fwrite(&this->size_, sizeof(size_t), 1, out) != 1) {
+            return false;
+        }
+        for (size_t i = 0; i < this->size_; ++i) {
+            int val = (int) this->vals_[i];
+            if (fwrite(&val, sizeof(int), 1, out) != 1) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    /**
+     * Replaces the values of this array by ones previously written with write().
+     * @param in the file to read from.
+     * @return whether all of it was read.
+     */
+    virtual bool read(FILE* in) {
+        size_t size;
+        if (fread(&size, sizeof(size_t), 1, in) != 1) {
+            return false;
+        }
+        this->clear();
+        for (size_t i = 0; i < size; ++i) {
+            int val;
+            if (fread(&val, sizeof(int), 1, in) != 1
+                || val < (int) Types::FIELD || val > (int) Types::STRING) {
+                return false;
+            }
+            this->pushBack((Types) val);
+        }
+        return true;
+    }
 };
@@ -0,0 +1,216 @@
+//lang::Cpp
+
+
+/**
+ * WindowScanner: Reads a .sor file one window of lines at a time
+ *
+ * Author: cao.yuan1@husky.neu.edu & zhan.d@husky.neu.edu
+ */
+
+
+#pragma once
+
+
+#include <algorithm>
+#include <cassert>
+#include <cstdlib>
+
+
+#include <unistd.h>
+#include <sys/mman.h>
+
+
+#include "object.h"
+
+
+// the memory limit is shared between the mapped window and what is built from it,
+// which takes up to a few times the size of the window
+const size_t WINDOW_SHARE = 8;
+
+// the number of bytes read at a time when looking for the end of a line
+const size_t WINDOW_SEEK_CHUNK = 4096;
+
+
+/**
+ * WindowScanner: represents a file mapped one window at a time so that at most a window
+ * of it is mapped at once, whatever the size of the file.
+ * A window always holds complete lines, the lines cut by its end are left to the next one.
+ * Positions in the window are relative to its first byte.
+ * INVARIANT: window_ is null when nothing is mapped.
+ */
+class WindowScanner : public Object {
+
+public:
+    int fd_; // the file descriptor of the file (external)
+    size_t file_size_; // the size of the file
+    size_t page_size_; // the size of a page
+    size_t window_size_; // the number of bytes mapped at a time, a multiple of the page size
+    char* map_; // the first byte mapped
+    size_t map_len_; // the number of bytes mapped
+    char* window_; // the first byte of the window, in the mapping
+    size_t window_start_; // where the window starts in the file
+    size_t window_len_; // the number of bytes of the complete lines in the window
+
+    /**
+     * Constructs a scanner of a file that keeps the memory used by a scan within a limit.
+     * @param fd the file descriptor of the file.
+     * @param file_size the size of the file.
+     * @param mem_limit the number of bytes a scan should use at most.
+     */
+    WindowScanner(int fd, size_t file_size, size_t mem_limit) : Object() {
+        this->fd_ = fd;
+        this->file_size_ = file_size;
+        this->page_size_ = getpagesize();
+        this->window_size_ = mem_limit / WINDOW_SHARE / this->page_size_ * this->page_size_;
+        if (this->window_size_ == 0) {
+            this->window_size_ = this->page_size_;
+        }
+        this->map_ = nullptr;
+        this->map_len_ = 0;
+        this->window_ = nullptr;
+        this->window_start_ = 0;
+        this->window_len_ = 0;
+    }
+
+    /**
+     * Default destructor, releases the window if one is mapped.
+     */
+    virtual ~WindowScanner() {
+        this->release();
+    }
+
+    /**
+     * Maps the lines starting at the given byte that fit in a window. A window is grown
+     * past the window size only if a single line does not fit in it.
+     * @param start the byte the window starts at, the start of a line.
+     * @param end the byte to stop at.
+     * @return false if there is nothing left to map, true otherwise.
+     */
+    virtual bool map(size_t start, size_t end) {
+        this->release();
+        if (start >= end || start >= this->file_size_) {
+            return false;
+        }
+        size_t offset = start - start % this->page_size_;
+        size_t len = this->window_size_;
+        while (true) {
+            bool to_eof = offset + len >= this->file_size_;
+            if (to_eof) {
+                len = this->file_size_ - offset;
+            }
+            void* map = mmap(nullptr, len, PROT_READ, MAP_PRIVATE, this->fd_, offset);
+            assert(map != MAP_FAILED);
+            this->map_ = (char*) map;
+            this->map_len_ = len;
+            this->window_ = this->map_ + (start - offset);
+            this->window_start_ = start;
+            size_t available = offset + len - start;
+            // the last line of the file is complete even without a '\n'
+            this->window_len_ = to_eof ? available : this->complete_len_(available);
+            if (this->window_len_ > 0) {
+                return true;
+            }
+            // a single line does not fit, try again with a bigger window
+            this->release();
+            len *= 2;
+        }
+    }
+
+    /**
+     * Gives the pages of the window back to the system and unmaps it.
+     */
+    virtual void release() {
+        if (this->map_) {
+            madvise(this->map_, this->map_len_, MADV_DONTNEED);
+            munmap(this->map_, this->map_len_);
+        }
+        this->map_ = nullptr;
+        this->map_len_ = 0;
+        this->window_ = nullptr;
+        this->window_len_ = 0;
+    }
+
+    /**
+     * Returns the start of the line after the one the given byte is in, the same way
+     * the first line cut by -from is discarded.
+     * @param from the byte.
+     * @return the start of the next line, or the size of the file if there is none.
+     */
+    virtual size_t next_line(size_t from) {
+        char buf[WINDOW_SEEK_CHUNK];
+        while (from < this->file_size_) {
+            ssize_t got = pread(this->fd_, buf, WINDOW_SEEK_CHUNK, from);
+            assert(got > 0);
+            for (ssize_t i = 0; i < got; ++i) {
+                if (buf[i] == '\n') {
+                    return from + i + 1;
+                }
+            }
+            from += got;
+        }
+        return this->file_size_;
+    }
+
+    /**
+     * Returns the last '\n' at or before the given byte, the same way the last line cut
+     * by -len is discarded.
+     * @param end the byte.
+     * @param from the byte not to go back past.
+     * @return the position of the '\n', or from if there is none after it, leaving
+     *         no line to read.
+     */
+    virtual size_t line_end(size_t end, size_t from) {
+        char buf[WINDOW_SEEK_CHUNK];
+        while (end > from) {
+            size_t chunk_start = end + 1 > WINDOW_SEEK_CHUNK ? end + 1 - WINDOW_SEEK_CHUNK : 0;
+            if (chunk_start < from) {
+                chunk_start = from;
+            }
+            ssize_t got = pread(this->fd_, buf, end + 1 - chunk_start, chunk_start);
+            assert(got == (ssize_t) (end + 1 - chunk_start));
+            for (size_t i = end + 1 - chunk_start; i > 0; --i) {
+                if (buf[i - 1] == '\n') {
+                    return chunk_start + i - 1;
+                }
+            }
+            end = chunk_start;
+        }
+        return from;
+    }
+
+    /**
+     * Counts the lines that end before the given byte, reading them without mapping them.
+     * @param end the byte to stop counting at.
+     * @return the number of '\n' before end.
+     */
+    virtual size_t count_lines(size_t end) {
+        char buf[WINDOW_SEEK_CHUNK];
+        size_t lines = 0;
+        for (size_t pos = 0; pos < end;) {
+            size_t chunk = std::min(WINDOW_SEEK_CHUNK, end - pos);
+            ssize_t got = pread(this->fd_, buf, chunk, pos);
+            assert(got > 0);
+            for (ssize_t i = 0; i < got; ++i) {
+                if (buf[i] == '\n') {
+                    ++lines;
+                }
+            }
+            pos += got;
+        }
+        return lines;
+    }
+
+    /**
+     * Returns the number of bytes of the complete lines at the start of the window.
+     * @param available the number of bytes mapped from the start of the window.
+     * @return the number of bytes up to and including the last '\n'.
+     */
+    virtual size_t complete_len_(size_t available) {
+        for (size_t i = available; i > 0; --i) {
+            if (this->window_[i - 1] == '\n') {
+                return i;
+            }
+        }
+        return 0;
+    }
+};